@@ -1,334 +1,534 @@
 #include "abstract_machine.h"
+#include "context.h"
 #include "utils.h"
+#include "ring.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 //--------------------------------------------------------------------------
 
-#define MAXLINESIZE 80
-#define MAXNUMLINES 4096
+static void grow_file(AsmFile *file, int line)
+{
+	while (line >= file->capacity) {
+		file->capacity = file->capacity ? 2 * file->capacity : 256;
+		file->out = realloc(file->out, file->capacity * sizeof(*file->out));
+
+		if (!file->out)
+			abort(); // out of memory
+	}
+}
+
+/*
+ * Pipelined emission: the lines are formatted on a thread of their own.
+ * The generator passes the format and the arguments of each line through
+ * a ring, the line numbers are only counted on its side. Fixes of earlier
+ * lines go through the ring as well, so they come after the lines.
+ */
+enum { PipeCapacity = 1 << 12 };
 
 typedef struct {
-	int  line;
-	char out[MAXNUMLINES][MAXLINESIZE];
-} AsmFile;
+	const char   *format;
+	int           line;
+	int           column;
+	unsigned char strings; // bit n is set if argument n is a string
+	union {
+		int         number;
+		const char *string;
+	} args[3];
+} Emission;
+
+struct CodePipe {
+	Ring      ring; // of Emission
+	pthread_t thread;
+};
+
+// The arguments have the types of the format's conversions, %s or %d
+static void format_emission(AsmFile *file, const Emission *e)
+{
+	char *text = file->out[e->line] + e->column;
+	size_t size = AM_LINE_SIZE - e->column;
+	const int n0 = e->args[0].number, n1 = e->args[1].number, n2 = e->args[2].number;
+	const char *s0 = e->args[0].string, *s1 = e->args[1].string, *s2 = e->args[2].string;
+
+	switch (e->strings) {
+	case 0: snprintf(text, size, e->format, n0, n1, n2); break;
+	case 1: snprintf(text, size, e->format, s0, n1, n2); break;
+	case 2: snprintf(text, size, e->format, n0, s1, n2); break;
+	case 3: snprintf(text, size, e->format, s0, s1, n2); break;
+	case 4: snprintf(text, size, e->format, n0, n1, s2); break;
+	case 5: snprintf(text, size, e->format, s0, n1, s2); break;
+	case 6: snprintf(text, size, e->format, n0, s1, s2); break;
+	case 7: snprintf(text, size, e->format, s0, s1, s2); break;
+	}
+}
+
+static void *emit_worker(void *argument)
+{
+	AsmFile *file = argument;
+	Emission *e;
+
+	while ((e = ring_peek(&file->pipe->ring))) {
+		grow_file(file, e->line);
+		format_emission(file, e);
+		ring_pop(&file->pipe->ring);
+	}
+
+	return NULL;
+}
+
+static void emit_pipelined(AsmFile *file, int line, int column, const char *format,
+                           va_list args)
+{
+	Emission *e = ring_reserve(&file->pipe->ring);
+	assert(e); // the emitter never cancels
+	e->format = format;
+	e->line = line;
+	e->column = column;
+	e->strings = 0;
+	int n = 0;
 
-static void print(AsmFile *out, int line, const char *format, ...)
+	for (const char *p = format; *p; p++) {
+		if (*p != '%' || *++p == '%')
+			continue;
+
+		while (*p >= '0' && *p <= '9')
+			p++;
+
+		assert(n < 3 && (*p == 's' || *p == 'd'));
+
+		if (*p == 's') {
+			e->strings |= 1 << n;
+			e->args[n].string = va_arg(args, const char *);
+		} else {
+			e->args[n].number = va_arg(args, int);
+		}
+
+		n++;
+	}
+
+	ring_push(&file->pipe->ring);
+}
+
+// Writes 'line' from 'column' on
+static void write_line(CompilerContext *ctx, int line, int column, const char *format, ...)
 {
+	AsmFile *file = &ctx->code;
 	va_list args;
 	va_start(args, format);
-	vsprintf(out->out[line], format, args);
+
+	if (file->pipe) {
+		emit_pipelined(file, line, column, format, args);
+	} else {
+		grow_file(file, line);
+		vsnprintf(file->out[line] + column, AM_LINE_SIZE - column, format, args);
+	}
+
 	va_end(args);
 }
 
-AsmFile g_out_file = {0};
+// Appends a line, counted as an instruction of 'kind' for the statistics
+#define PRINT(kind, format, ...) \
+	do { \
+		ctx->stats.instructions[kind] += 1; \
+		write_line(ctx, ctx->code.line++, 0, format, ## __VA_ARGS__); \
+	} while (0)
 
-#define PRINT(format, ...) print(&g_out_file, g_out_file.line++, format, ## __VA_ARGS__)
+void am_set_pipeline(CompilerContext *ctx, bool pipeline)
+{
+	ctx->code.pipeline = pipeline;
+}
 
-void print_file()
+// The lines of earlier compilations are reused
+void am_init(CompilerContext *ctx)
 {
-	for (int i = 0; i < g_out_file.line; i++) {
-		printf("%3d: %s", i, g_out_file.out[i]);
+	AsmFile *file = &ctx->code;
+	file->line = 0;
+
+	if (file->pipeline) {
+		file->pipe = malloc(sizeof(*file->pipe));
+
+		if (!file->pipe)
+			abort(); // out of memory
+
+		ring_init(&file->pipe->ring, sizeof(Emission), PipeCapacity);
+
+		if (pthread_create(&file->pipe->thread, NULL, emit_worker, file) != 0)
+			abort();
 	}
 }
 
+void am_finish(CompilerContext *ctx)
+{
+	AsmFile *file = &ctx->code;
+
+	if (!file->pipe)
+		return;
+
+	ring_close(&file->pipe->ring);
+	pthread_join(file->pipe->thread, NULL);
+	ring_free(&file->pipe->ring);
+	free(file->pipe);
+	file->pipe = NULL;
+}
+
+void am_release(CompilerContext *ctx)
+{
+	am_finish(ctx);
+	free(ctx->code.out);
+	ctx->code.out = NULL;
+	ctx->code.capacity = 0;
+	ctx->code.line = 0;
+}
+
 //--------------------------------------------------------------------------
 
-#define MAX_REGISTERS 16
-static int g_registers[MAX_REGISTERS];
-static char *Name[MAX_REGISTERS] = {
+static const char *Name[] = {
 	"R0", "R1", "R2", "R3",
 	"R4", "R5", "R6", "R7",
 	"R8", "R9", "R10", "R11",
 	"R12", "GB", "SP", "LNK",
 };
 
-int am_get_pc(void)
+const char *am_get_kind_name(int kind)
 {
-	return g_out_file.line;
+	static const char *Names[] = {
+		[OP_MOV] = "mov", [OP_NOT] = "not", [OP_AND] = "and", [OP_OR] = "or",
+		[OP_XOR] = "xor", [OP_LSH] = "lsh", [OP_RSH] = "rsh", [OP_ADD] = "add",
+		[OP_SUB] = "sub", [OP_MUL] = "mul", [OP_DIV] = "div", [OP_MOD] = "mod",
+		[OP_CMP] = "cmp", [OP_SET] = "set", [OP_CMOV] = "cmov",
+		[AM_LOAD] = "load", [AM_STORE] = "store", [AM_JUMP] = "jump",
+		[AM_LABEL] = "label", [AM_IO] = "io",
+	};
+
+	assert(kind >= 0 && kind < AM_KIND_COUNT);
+	return Names[kind];
+}
+
+int am_get_pc(CompilerContext *ctx)
+{
+	return ctx->code.line;
 }
-void am_fix_jump(int at, int with)
+void am_fix_jump(CompilerContext *ctx, int at, int with)
 {
 	// 'at'must be a jump instruction!!!
-	char *text = g_out_file.out[at];
-	sprintf(text + 4, "%3d\n", with);
-	// scan to the number and overwrite it with relative jump_address
+	// overwrite the number behind the opcode with the relative jump_address
+	write_line(ctx, at, 4, "%3d\n", with);
+	ctx->stats.fixups += 1;
 }
 
-int am_get_jump_location(int abs_location)
+// Re-emits an immediate operation in place, e.g. a frame size that is only
+// known at the end of a procedure
+void am_fix_operation_im(CompilerContext *ctx, int at, Operation op, reg_index a, reg_index b,
+                         int value)
 {
-	const char *text = g_out_file.out[abs_location];
-	const char *num = text + 4;
+	int line = ctx->code.line;
+	ctx->code.line = at;
+	am_emit_operation_im(ctx, op, a, b, value);
+	ctx->code.line = line;
+	ctx->stats.instructions[op] -= 1; // replaced, not added
+	ctx->stats.fixups += 1;
+}
 
-	char buffer[512];
-	int d = 0;
+void am_discard(CompilerContext *ctx, int from)
+{
+	assert(from <= ctx->code.line);
+	ctx->code.line = from;
+}
 
-	for (int i = 0; i < 3; i += 1) {
-		if (is_digit(num[i])) {
-			buffer[d++] = num[i];
-		}
-	}
+void am_emit_label(CompilerContext *ctx, const char *name)
+{
+	PRINT(AM_LABEL, "%s:\n", name);
+}
 
-	buffer[d] = '\0';
-	int n = to_number(buffer);
-	return n;
+// Emit Code
+void am_emit_mov(CompilerContext *ctx, reg_index dest, reg_index src)
+{
+	PRINT(OP_MOV, "%s := %s\n", Name[dest], Name[src]);
 }
 
-void am_emit_label(const char *name)
+void am_emit_cmp(CompilerContext *ctx, reg_index reg1, reg_index reg2)
 {
-	PRINT("%s:\n", name);
+	PRINT(OP_CMP, "cmp %s, %s\n", Name[reg1], Name[reg2]);
 }
 
-// Emit Code
-void am_emit_mov(reg_index dest, reg_index src)
+void am_emit_and(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
+{
+	PRINT(OP_AND, "%s := %s and %s\n", Name[dest], Name[lhs], Name[rhs]);
+}
+
+void am_emit_or(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s\n", Name[dest], Name[src]);
+	PRINT(OP_OR, "%s := %s or %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_cmp(reg_index reg1, reg_index reg2)
+void am_emit_xor(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("cmp %s, %s\n", Name[reg1], Name[reg2]);
+	PRINT(OP_XOR, "%s := %s xor %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_and(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_add(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s and %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_ADD, "%s := %s + %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_or (reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_sub(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s or %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_SUB, "%s := %s - %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_xor(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_mul(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s xor %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_MUL, "%s := %s * %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_add(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_div(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s + %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_DIV, "%s := %s / %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_sub(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_lsh(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s - %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_LSH, "%s := %s << %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_mul(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_rsh(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s * %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_RSH, "%s := %s >> %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_div(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_mod(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs)
 {
-	PRINT("%s := %s / %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_MOD, "%s := %s %% %s\n", Name[dest], Name[lhs], Name[rhs]);
 }
 
-void am_emit_lsh(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_mov_im(CompilerContext *ctx, reg_index dest, int value)
 {
-	PRINT("%s := %s << %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_MOV, "%s := %d\n",        Name[dest], value);
 }
 
-void am_emit_rsh(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_cmp_im(CompilerContext *ctx, reg_index reg, int value)
 {
-	PRINT("%s := %s >> %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_CMP, "cmp %s, %d\n",      Name[reg], value);
 }
 
-void am_emit_mod(reg_index dest, reg_index lhs, reg_index rhs)
+void am_emit_and_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s %% %s\n", Name[dest], Name[lhs], Name[rhs]);
+	PRINT(OP_AND, "%s := %s and %d\n", Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_mov_im(reg_index dest, int value)
+void am_emit_or_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %d\n",        Name[dest], value);
+	PRINT(OP_OR,  "%s := %s or %d\n",  Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_cmp_im(reg_index reg, int value)
+void am_emit_xor_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("cmp %s, %d\n",      Name[reg], value);
+	PRINT(OP_XOR, "%s := %s xor %d\n", Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_and_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_add_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s and %d\n", Name[dest], Name[lhs], rhs_value);
+	PRINT(OP_ADD, "%s := %s + %d\n",   Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_or_im (reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_sub_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s or %d\n",  Name[dest], Name[lhs], rhs_value);
+	PRINT(OP_SUB, "%s := %s - %d\n",   Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_xor_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_mul_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s xor %d\n", Name[dest], Name[lhs], rhs_value);
+	PRINT(OP_MUL, "%s := %s * %d\n",   Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_add_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_div_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s + %d\n",   Name[dest], Name[lhs], rhs_value);
+	PRINT(OP_DIV, "%s := %s / %d\n",   Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_sub_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_lsh_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s - %d\n",   Name[dest], Name[lhs], rhs_value);
+	PRINT(OP_LSH, "%s := %s << %d\n",  Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_mul_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_rsh_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s * %d\n",   Name[dest], Name[lhs], rhs_value);
+	PRINT(OP_RSH, "%s := %s >> %d\n",  Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_div_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_mod_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value)
 {
-	PRINT("%s := %s / %d\n",   Name[dest], Name[lhs], rhs_value);
+	PRINT(OP_MOD, "%s := %s %% %d\n",  Name[dest], Name[lhs], rhs_value);
 }
 
-void am_emit_lsh_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_load(CompilerContext *ctx, reg_index dest, reg_index base_reg, int offset)
+{
+	PRINT(AM_LOAD, "%s := mem[%s + %d]\n", Name[dest], Name[base_reg], offset);
+}
+
+void am_emit_store(CompilerContext *ctx, reg_index src, reg_index base_reg, int offset)
+{
+	PRINT(AM_STORE, "mem[%s + %d] := %s\n", Name[base_reg], offset, Name[src]);
+}
+
+static const char *ConditionName[] = {
+	[CC_EQUAL]         = "e",
+	[CC_NOT_EQUAL]     = "ne",
+	[CC_LESS]          = "l",
+	[CC_LESS_EQUAL]    = "le",
+	[CC_GREATER]       = "g",
+	[CC_GREATER_EQUAL] = "ge",
+};
+
+void am_emit_set(CompilerContext *ctx, ConditionCode cc, reg_index dest)
 {
-	PRINT("%s := %s << %d\n",  Name[dest], Name[lhs], rhs_value);
+	assert(cc != CC_TRUE && cc != CC_FALSE);
+	PRINT(OP_SET, "set%s %s\n", ConditionName[cc], Name[dest]);
 }
 
-void am_emit_rsh_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_cmov(CompilerContext *ctx, ConditionCode cc, reg_index dest, reg_index src)
 {
-	PRINT("%s := %s >> %d\n",  Name[dest], Name[lhs], rhs_value);
+	assert(cc != CC_TRUE && cc != CC_FALSE);
+	PRINT(OP_CMOV, "cmov%s %s, %s\n", ConditionName[cc], Name[dest], Name[src]);
 }
 
-void am_emit_mod_im(reg_index dest, reg_index lhs, int rhs_value)
+void am_emit_read(CompilerContext *ctx, reg_index dest)
 {
-	PRINT("%s := %s %% %d\n",  Name[dest], Name[lhs], rhs_value);
+	PRINT(AM_IO, "read %s\n", Name[dest]);
 }
 
-void am_emit_load(reg_index dest, reg_index base_reg, int offset)
+void am_emit_write(CompilerContext *ctx, reg_index src)
 {
-	PRINT("%s := mem[%s + %d]\n", Name[dest], Name[base_reg], offset);
+	PRINT(AM_IO, "write %s\n", Name[src]);
 }
 
-void am_emit_store(reg_index src, reg_index base_reg, int offset)
+void am_emit_write_line(CompilerContext *ctx)
 {
-	PRINT("mem[%s + %d] := %s\n", Name[base_reg], offset, Name[src]);
+	PRINT(AM_IO, "writeln\n");
 }
 
-void am_emit_jump_im(int relative)
+void am_emit_jump_im(CompilerContext *ctx, int relative)
 {
-	PRINT("jmp %3d\n", relative);
+	PRINT(AM_JUMP, "jmp %3d\n", relative);
 }
 
-void am_emit_jump_equal_im(int relative)
+void am_emit_jump_equal_im(CompilerContext *ctx, int relative)
 {
-	PRINT("je  %3d\n", relative);
+	PRINT(AM_JUMP, "je  %3d\n", relative);
 }
 
-void am_emit_jump_not_equal_im(int relative)
+void am_emit_jump_not_equal_im(CompilerContext *ctx, int relative)
 {
-	PRINT("jne %3d\n", relative);
+	PRINT(AM_JUMP, "jne %3d\n", relative);
 }
 
-void am_emit_jump_less_im(int relative)
+void am_emit_jump_less_im(CompilerContext *ctx, int relative)
 {
-	PRINT("jl  %3d\n", relative);
+	PRINT(AM_JUMP, "jl  %3d\n", relative);
 }
 
-void am_emit_jump_less_equal_im(int relative)
+void am_emit_jump_less_equal_im(CompilerContext *ctx, int relative)
 {
-	PRINT("jle %3d\n", relative);
+	PRINT(AM_JUMP, "jle %3d\n", relative);
 }
 
-void am_emit_jump_greater_im(int relative)
+void am_emit_jump_greater_im(CompilerContext *ctx, int relative)
 {
-	PRINT("jg  %3d\n", relative);
+	PRINT(AM_JUMP, "jg  %3d\n", relative);
 }
 
-void am_emit_jump_greater_euqal_im(int relative)
+void am_emit_jump_greater_euqal_im(CompilerContext *ctx, int relative)
 {
-	PRINT("jge %3d\n", relative);
+	PRINT(AM_JUMP, "jge %3d\n", relative);
 }
 
-void am_emit_jump(reg_index reg)
+void am_emit_jump(CompilerContext *ctx, reg_index reg)
 {
-	PRINT("jmp %s\n", Name[reg]);
+	PRINT(AM_JUMP, "jmp %s\n", Name[reg]);
 }
 
-void am_emit_jump_equal(reg_index reg)
+void am_emit_jump_equal(CompilerContext *ctx, reg_index reg)
 {
-	PRINT("je  %s\n", Name[reg]);
+	PRINT(AM_JUMP, "je  %s\n", Name[reg]);
 }
 
-void am_emit_jump_not_equal(reg_index reg)
+void am_emit_jump_not_equal(CompilerContext *ctx, reg_index reg)
 {
-	PRINT("jne %s\n", Name[reg]);
+	PRINT(AM_JUMP, "jne %s\n", Name[reg]);
 }
 
-void am_emit_jump_less(reg_index reg)
+void am_emit_jump_less(CompilerContext *ctx, reg_index reg)
 {
-	PRINT("jl  %s\n", Name[reg]);
+	PRINT(AM_JUMP, "jl  %s\n", Name[reg]);
 }
 
-void am_emit_jump_less_equal(reg_index reg)
+void am_emit_jump_less_equal(CompilerContext *ctx, reg_index reg)
 {
-	PRINT("jle %s\n", Name[reg]);
+	PRINT(AM_JUMP, "jle %s\n", Name[reg]);
 }
 
-void am_emit_jump_greater(reg_index reg)
+void am_emit_jump_greater(CompilerContext *ctx, reg_index reg)
 {
-	PRINT("jg  %s\n", Name[reg]);
+	PRINT(AM_JUMP, "jg  %s\n", Name[reg]);
 }
 
-void am_emit_jump_greater_euqal(reg_index reg)
+void am_emit_jump_greater_euqal(CompilerContext *ctx, reg_index reg)
 {
-	PRINT("jge %s\n", Name[reg]);
+	PRINT(AM_JUMP, "jge %s\n", Name[reg]);
 }
 
-void am_emit_operation(Operation op, reg_index a, reg_index b, reg_index c)
+void am_emit_operation(CompilerContext *ctx, Operation op, reg_index a, reg_index b,
+                       reg_index c)
 {
 	switch (op) {
-		//break;case OP_MOV: am_emit_mov(a,c);
+		//break;case OP_MOV: am_emit_mov(ctx, a,c);
 		break;
 
 	case OP_AND:
-		am_emit_and(a, b, c);
+		am_emit_and(ctx, a, b, c);
 		break;
 
 	case OP_OR:
-		am_emit_or(a, b, c);
+		am_emit_or(ctx, a, b, c);
 		break;
 
 	case OP_XOR:
-		am_emit_xor(a, b, c);
+		am_emit_xor(ctx, a, b, c);
 		break;
 
 	case OP_LSH:
-		am_emit_lsh(a, b, c);
+		am_emit_lsh(ctx, a, b, c);
 		break;
 
 	case OP_RSH:
-		am_emit_rsh(a, b, c);
+		am_emit_rsh(ctx, a, b, c);
 		break;
 
 	case OP_ADD:
-		am_emit_add(a, b, c);
+		am_emit_add(ctx, a, b, c);
 		break;
 
 	case OP_SUB:
-		am_emit_sub(a, b, c);
+		am_emit_sub(ctx, a, b, c);
 		break;
 
 	case OP_MUL:
-		am_emit_mul(a, b, c);
+		am_emit_mul(ctx, a, b, c);
 		break;
 
 	case OP_DIV:
-		am_emit_div(a, b, c);
+		am_emit_div(ctx, a, b, c);
 		break;
 
 	case OP_MOD:
-		am_emit_mod(a, b, c);
+		am_emit_mod(ctx, a, b, c);
 		break;
 
 	case OP_CMP:
-		am_emit_cmp(b, c);
+		am_emit_cmp(ctx, b, c);
 		break;
 
 	default:
@@ -337,54 +537,55 @@ void am_emit_operation(Operation op, reg_index a, reg_index b, reg_index c)
 	}
 }
 
-void am_emit_operation_im(Operation op, reg_index a, reg_index b, int value)
+void am_emit_operation_im(CompilerContext *ctx, Operation op, reg_index a, reg_index b,
+                          int value)
 {
 	switch (op) {
-		//break;case OP_MOV: am_emit_mov_im(a,value);
+		//break;case OP_MOV: am_emit_mov_im(ctx, a,value);
 		break;
 
 	case OP_AND:
-		am_emit_and_im(a, b, value);
+		am_emit_and_im(ctx, a, b, value);
 		break;
 
 	case OP_OR:
-		am_emit_or_im(a, b, value);
+		am_emit_or_im(ctx, a, b, value);
 		break;
 
 	case OP_XOR:
-		am_emit_xor_im(a, b, value);
+		am_emit_xor_im(ctx, a, b, value);
 		break;
 
 	case OP_LSH:
-		am_emit_lsh_im(a, b, value);
+		am_emit_lsh_im(ctx, a, b, value);
 		break;
 
 	case OP_RSH:
-		am_emit_rsh_im(a, b, value);
+		am_emit_rsh_im(ctx, a, b, value);
 		break;
 
 	case OP_ADD:
-		am_emit_add_im(a, b, value);
+		am_emit_add_im(ctx, a, b, value);
 		break;
 
 	case OP_SUB:
-		am_emit_sub_im(a, b, value);
+		am_emit_sub_im(ctx, a, b, value);
 		break;
 
 	case OP_MUL:
-		am_emit_mul_im(a, b, value);
+		am_emit_mul_im(ctx, a, b, value);
 		break;
 
 	case OP_DIV:
-		am_emit_div_im(a, b, value);
+		am_emit_div_im(ctx, a, b, value);
 		break;
 
 	case OP_MOD:
-		am_emit_mod_im(a, b, value);
+		am_emit_mod_im(ctx, a, b, value);
 		break;
 
 	case OP_CMP: 
-		am_emit_cmp_im(a, value); // check if we pass the correct params
+		am_emit_cmp_im(ctx, a, value); // check if we pass the correct params
 		break;
 
 	default:
@@ -415,40 +616,40 @@ ConditionCode negate_condition(ConditionCode cc)
 	return 0;
 }
 
-void am_emit_c_jump_im(ConditionCode cc, int relative)
+void am_emit_c_jump_im(CompilerContext *ctx, ConditionCode cc, int relative)
 {
 	switch (cc) {
 		break;
 
 	case CC_TRUE:
-		am_emit_jump_im(relative);
+		am_emit_jump_im(ctx, relative);
 		break;
 
 	case CC_FALSE:         // never
 		break;
 
 	case CC_EQUAL:
-		am_emit_jump_equal_im(relative);
+		am_emit_jump_equal_im(ctx, relative);
 		break;
 
 	case CC_NOT_EQUAL:
-		am_emit_jump_not_equal_im(relative);
+		am_emit_jump_not_equal_im(ctx, relative);
 		break;
 
 	case CC_LESS:
-		am_emit_jump_less_im(relative);
+		am_emit_jump_less_im(ctx, relative);
 		break;
 
 	case CC_LESS_EQUAL:
-		am_emit_jump_less_equal_im(relative);
+		am_emit_jump_less_equal_im(ctx, relative);
 		break;
 
 	case CC_GREATER:
-		am_emit_jump_greater_im(relative);
+		am_emit_jump_greater_im(ctx, relative);
 		break;
 
 	case CC_GREATER_EQUAL:
-		am_emit_jump_greater_euqal_im(relative);
+		am_emit_jump_greater_euqal_im(ctx, relative);
 		break;
 
 	default:
@@ -457,40 +658,40 @@ void am_emit_c_jump_im(ConditionCode cc, int relative)
 	}
 }
 
-void am_emit_c_jump(ConditionCode cc, reg_index reg)
+void am_emit_c_jump(CompilerContext *ctx, ConditionCode cc, reg_index reg)
 {
 	switch (cc) {
 		break;
 
 	case CC_TRUE:
-		am_emit_jump(reg);
+		am_emit_jump(ctx, reg);
 		break;
 
 	case CC_FALSE:         // never
 		break;
 
 	case CC_EQUAL:
-		am_emit_jump_equal(reg);
+		am_emit_jump_equal(ctx, reg);
 		break;
 
 	case CC_NOT_EQUAL:
-		am_emit_jump_not_equal(reg);
+		am_emit_jump_not_equal(ctx, reg);
 		break;
 
 	case CC_LESS:
-		am_emit_jump_less(reg);
+		am_emit_jump_less(ctx, reg);
 		break;
 
 	case CC_LESS_EQUAL:
-		am_emit_jump_less_equal(reg);
+		am_emit_jump_less_equal(ctx, reg);
 		break;
 
 	case CC_GREATER:
-		am_emit_jump_greater(reg);
+		am_emit_jump_greater(ctx, reg);
 		break;
 
 	case CC_GREATER_EQUAL:
-		am_emit_jump_greater_euqal(reg);
+		am_emit_jump_greater_euqal(ctx, reg);
 		break;
 
 	default:
@@ -5,8 +5,22 @@ typedef int reg_index;
 #ifndef __cplusplus
 typedef enum Operation Operation;
 typedef enum ConditionCode ConditionCode;
+typedef struct AsmFile AsmFile;
+typedef struct CodePipe CodePipe;
+typedef struct CompilerContext CompilerContext;
 #endif
 
+#define AM_LINE_SIZE 80
+
+// The emitted code, one instruction or label per line
+struct AsmFile {
+	int  line;     // next line to emit, the program counter
+	int  capacity; // lines allocated
+	char (*out)[AM_LINE_SIZE];
+	bool pipeline; // lines are formatted on a thread of their own
+	CodePipe *pipe; // to that thread, while a compilation runs
+};
+
 enum Operation {
 	OP_MOV,
 	OP_NOT, // Bitwise
@@ -21,6 +35,19 @@ enum Operation {
 	OP_DIV,
 	OP_MOD,
 	OP_CMP,
+	OP_SET,  // dest := condition ? 1 : 0
+	OP_CMOV, // if condition then dest := src
+};
+
+// Kinds of instructions counted in CompilerStats, the operations followed
+// by these. Must be in sync with CompilerInstructionKinds.
+enum {
+	AM_LOAD = OP_CMOV + 1,
+	AM_STORE,
+	AM_JUMP, // conditional too
+	AM_LABEL,
+	AM_IO,   // read, write and writeln
+	AM_KIND_COUNT
 };
 
 enum ConditionCode {
@@ -37,69 +64,89 @@ enum ConditionCode {
 // Convenience API
 // -----------------------------------------------------------------------------
 ConditionCode negate_condition(ConditionCode cc);
-int  am_get_pc(void);
-int  am_get_jump_location(int absolute_loc);
-void am_fix_jump(int at, int with);
-void am_emit_operation(Operation op, reg_index a, reg_index b, reg_index c);
-void am_emit_operation_im(Operation op, reg_index a, reg_index b, int value);
-void am_emit_c_jump_im(ConditionCode cc, int relative);
-void am_emit_c_jump(ConditionCode cc, reg_index reg);
+const char *am_get_kind_name(int kind);
+void am_set_pipeline(CompilerContext *ctx, bool pipeline);
+void am_init(CompilerContext *ctx);    // starts an empty file
+void am_finish(CompilerContext *ctx);  // all lines are there afterwards
+void am_release(CompilerContext *ctx);
+int  am_get_pc(CompilerContext *ctx);
+void am_fix_jump(CompilerContext *ctx, int at, int with);
+void am_fix_operation_im(CompilerContext *ctx, int at, Operation op, reg_index a, reg_index b,
+                         int value);
+void am_discard(CompilerContext *ctx, int from); // drops the code emitted from 'from' on
+void am_emit_operation(CompilerContext *ctx, Operation op, reg_index a, reg_index b,
+                       reg_index c);
+void am_emit_operation_im(CompilerContext *ctx, Operation op, reg_index a, reg_index b,
+                          int value);
+void am_emit_c_jump_im(CompilerContext *ctx, ConditionCode cc, int relative);
+void am_emit_c_jump(CompilerContext *ctx, ConditionCode cc, reg_index reg);
 // -----------------------------------------------------------------------------
-void am_emit_label(const char *name); // just for notes
+void am_emit_label(CompilerContext *ctx, const char *name); // just for notes
 // -----------------------------------------------------------------------------
 // Specific API
 // -----------------------------------------------------------------------------
 // Format 0 Register Opcodes
 // -----------------------------------------------------------------------------
-void am_emit_mov(reg_index dest, reg_index src);
-void am_emit_cmp(reg_index reg1, reg_index reg2);
-void am_emit_and(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_or (reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_xor(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_add(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_sub(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_mul(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_div(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_lsh(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_rsh(reg_index dest, reg_index lhs, reg_index rhs);
-void am_emit_mod(reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_mov(CompilerContext *ctx, reg_index dest, reg_index src);
+void am_emit_cmp(CompilerContext *ctx, reg_index reg1, reg_index reg2);
+void am_emit_and(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_or(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_xor(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_add(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_sub(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_mul(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_div(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_lsh(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_rsh(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
+void am_emit_mod(CompilerContext *ctx, reg_index dest, reg_index lhs, reg_index rhs);
 // -----------------------------------------------------------------------------
 // Format 1 Immediate Opcodes
 // -----------------------------------------------------------------------------
-void am_emit_mov_im(reg_index dest, int value);
-void am_emit_cmp_im(reg_index reg, int value);
-void am_emit_and_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_or_im (reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_xor_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_add_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_sub_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_mul_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_div_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_lsh_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_rsh_im(reg_index dest, reg_index lhs, int rhs_value);
-void am_emit_mod_im(reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_mov_im(CompilerContext *ctx, reg_index dest, int value);
+void am_emit_cmp_im(CompilerContext *ctx, reg_index reg, int value);
+void am_emit_and_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_or_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_xor_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_add_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_sub_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_mul_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_div_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_lsh_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_rsh_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
+void am_emit_mod_im(CompilerContext *ctx, reg_index dest, reg_index lhs, int rhs_value);
 // -----------------------------------------------------------------------------
 // Format 2 Load/Store Opcodes
 // -----------------------------------------------------------------------------
-void am_emit_load(reg_index dest, reg_index base_reg, int offset);
-void am_emit_store(reg_index src, reg_index base_reg, int offset);
+void am_emit_load(CompilerContext *ctx, reg_index dest, reg_index base_reg, int offset);
+void am_emit_store(CompilerContext *ctx, reg_index src, reg_index base_reg, int offset);
+// -----------------------------------------------------------------------------
+// Format 4 Conditional Opcodes, they test the flags of the last cmp
+// -----------------------------------------------------------------------------
+void am_emit_set(CompilerContext *ctx, ConditionCode cc, reg_index dest);
+void am_emit_cmov(CompilerContext *ctx, ConditionCode cc, reg_index dest, reg_index src);
+// -----------------------------------------------------------------------------
+// Input and output of integers
+// -----------------------------------------------------------------------------
+void am_emit_read(CompilerContext *ctx, reg_index dest);
+void am_emit_write(CompilerContext *ctx, reg_index src);
+void am_emit_write_line(CompilerContext *ctx);
 // -----------------------------------------------------------------------------
 // Format 3 Jump Opcodes
 // -----------------------------------------------------------------------------
-void am_emit_jump(reg_index reg);
-void am_emit_jump_equal(reg_index reg);
-void am_emit_jump_not_equal(reg_index reg);
-void am_emit_jump_less(reg_index reg);
-void am_emit_jump_less_equal(reg_index reg);
-void am_emit_jump_greater(reg_index reg);
-void am_emit_jump_greater_euqal(reg_index reg);
-// -----------------------------------------------------------------------------
-void am_emit_jump_im(int relative);
-void am_emit_jump_equal_im(int relative);
-void am_emit_jump_not_equal_im(int relative);
-void am_emit_jump_less_im(int relative);
-void am_emit_jump_less_equal_im(int relative);
-void am_emit_jump_greater_im(int relative);
-void am_emit_jump_greater_euqal_im(int relative);
+void am_emit_jump(CompilerContext *ctx, reg_index reg);
+void am_emit_jump_equal(CompilerContext *ctx, reg_index reg);
+void am_emit_jump_not_equal(CompilerContext *ctx, reg_index reg);
+void am_emit_jump_less(CompilerContext *ctx, reg_index reg);
+void am_emit_jump_less_equal(CompilerContext *ctx, reg_index reg);
+void am_emit_jump_greater(CompilerContext *ctx, reg_index reg);
+void am_emit_jump_greater_euqal(CompilerContext *ctx, reg_index reg);
+// -----------------------------------------------------------------------------
+void am_emit_jump_im(CompilerContext *ctx, int relative);
+void am_emit_jump_equal_im(CompilerContext *ctx, int relative);
+void am_emit_jump_not_equal_im(CompilerContext *ctx, int relative);
+void am_emit_jump_less_im(CompilerContext *ctx, int relative);
+void am_emit_jump_less_equal_im(CompilerContext *ctx, int relative);
+void am_emit_jump_greater_im(CompilerContext *ctx, int relative);
+void am_emit_jump_greater_euqal_im(CompilerContext *ctx, int relative);
 
 #endif // ABSTRACT_MACHINE_H
@@ -0,0 +1,102 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum { ChunkSize = 64 * 1024, Alignment = 16 };
+
+// Header of a chunk, the union keeps the memory behind it aligned for any
+// object
+struct ArenaChunk {
+	union {
+		struct {
+			ArenaChunk *next;
+			size_t      size; // bytes behind the header
+			size_t      used;
+		};
+		long double align_float;
+		long long   align_int;
+		void       *align_pointer;
+	};
+};
+
+static size_t align(size_t size)
+{
+	return (size + Alignment - 1) & ~(size_t)(Alignment - 1);
+}
+
+// Reuses a spare chunk big enough or allocates a new one
+static ArenaChunk *take_chunk(Arena *arena, size_t size)
+{
+	for (ArenaChunk **it = &arena->spare; *it; it = &(*it)->next) {
+		if ((*it)->size >= size) {
+			ArenaChunk *chunk = *it;
+			*it = chunk->next;
+			return chunk;
+		}
+	}
+
+	if (size < ChunkSize)
+		size = ChunkSize;
+
+	ArenaChunk *chunk = malloc(sizeof(*chunk) + size);
+
+	if (!chunk)
+		abort(); // out of memory
+
+	chunk->size = size;
+	return chunk;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	size = align(size);
+	ArenaChunk *chunk = arena->current;
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = take_chunk(arena, size);
+		chunk->used = 0;
+		chunk->next = arena->current;
+		arena->current = chunk;
+	}
+
+	void *memory = (char *)(chunk + 1) + chunk->used;
+	chunk->used += size;
+	memset(memory, 0, size);
+	return memory;
+}
+
+ArenaMark arena_mark(Arena *arena)
+{
+	ArenaMark mark = {arena->current, arena->current ? arena->current->used : 0};
+	return mark;
+}
+
+void arena_release(Arena *arena, ArenaMark mark)
+{
+	while (arena->current != mark.chunk) {
+		ArenaChunk *chunk = arena->current;
+		arena->current = chunk->next;
+		chunk->next = arena->spare;
+		arena->spare = chunk;
+	}
+
+	if (mark.chunk)
+		mark.chunk->used = mark.used;
+}
+
+static void free_chunks(ArenaChunk *chunk)
+{
+	while (chunk) {
+		ArenaChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+void arena_free(Arena *arena)
+{
+	free_chunks(arena->current);
+	free_chunks(arena->spare);
+	arena->current = NULL;
+	arena->spare = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#ifndef __cplusplus
+typedef struct ArenaChunk ArenaChunk;
+#endif
+
+// Region allocator: memory is handed out from large chunks and given back
+// all at once by releasing to an earlier mark. Released chunks are kept
+// for reuse until arena_free.
+typedef struct {
+	ArenaChunk *current; // chunk allocated from, heads the used chunks
+	ArenaChunk *spare;   // released chunks
+} Arena;
+
+// Allocation state to return to with arena_release
+typedef struct {
+	ArenaChunk *chunk;
+	size_t      used;
+} ArenaMark;
+
+void     *arena_alloc(Arena *arena, size_t size); // zeroed, aborts if out of memory
+ArenaMark arena_mark(Arena *arena);
+void      arena_release(Arena *arena, ArenaMark mark); // all since the mark
+void      arena_free(Arena *arena);
+
+#endif // ARENA_H
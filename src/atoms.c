@@ -0,0 +1,132 @@
+#include "atoms.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct AtomEntry {
+	unsigned hash;
+	int      length;
+	size_t   offset; // of the name in the text
+};
+
+static void *grow(void *memory, size_t size)
+{
+	memory = realloc(memory, size);
+
+	if (!memory)
+		abort(); // out of memory
+
+	return memory;
+}
+
+// FNV-1a
+static unsigned hash_name(const char *name, int length)
+{
+	unsigned hash = 2166136261u;
+
+	for (int i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+
+	return hash;
+}
+
+static void index_entry(AtomTable *table, Atom atom)
+{
+	int slot = table->entries[atom].hash & table->index_mask;
+
+	while (table->index[slot] != 0)
+		slot = (slot + 1) & table->index_mask;
+
+	table->index[slot] = atom;
+}
+
+// Keeps the index at most half full
+static void rebuild_index(AtomTable *table, int size)
+{
+	table->index = grow(table->index, size * sizeof(*table->index));
+	table->index_mask = size - 1;
+	memset(table->index, 0, size * sizeof(*table->index));
+
+	for (Atom atom = 1; atom < table->count; atom++)
+		index_entry(table, atom);
+}
+
+Atom atom_intern(AtomTable *table, const char *name, int length)
+{
+	if (table->count == 0) {
+		table->count = 1; // atom 0 stays unused
+		rebuild_index(table, 256);
+	}
+
+	unsigned hash = hash_name(name, length);
+	int slot = hash & table->index_mask;
+
+	while (table->index[slot] != 0) {
+		Atom atom = table->index[slot];
+		AtomEntry *entry = &table->entries[atom];
+
+		if (entry->hash == hash && entry->length == length
+		    && memcmp(table->text + entry->offset, name, length) == 0)
+			return atom;
+
+		slot = (slot + 1) & table->index_mask;
+	}
+
+	if (table->count >= table->capacity) {
+		table->capacity = table->capacity ? 2 * table->capacity : 256;
+		table->entries = grow(table->entries, table->capacity * sizeof(*table->entries));
+	}
+
+	if (table->text_length + length + 1 > table->text_capacity) {
+		table->text_capacity = 2 * table->text_capacity + length + 1;
+		table->text = grow(table->text, table->text_capacity);
+	}
+
+	Atom atom = table->count++;
+	AtomEntry *entry = &table->entries[atom];
+	entry->hash = hash;
+	entry->length = length;
+	entry->offset = table->text_length;
+	memcpy(table->text + table->text_length, name, length);
+	table->text[table->text_length + length] = '\0';
+	table->text_length += length + 1;
+
+	if (2 * table->count > table->index_mask + 1)
+		rebuild_index(table, 2 * (table->index_mask + 1));
+	else
+		table->index[slot] = atom;
+
+	return atom;
+}
+
+const char *atom_name(const AtomTable *table, Atom atom)
+{
+	assert(atom > 0 && atom < table->count);
+	return table->text + table->entries[atom].offset;
+}
+
+int atom_count(const AtomTable *table)
+{
+	return table->count;
+}
+
+void atom_truncate(AtomTable *table, int count)
+{
+	if (count < 1)
+		count = 1;
+
+	if (count >= table->count)
+		return;
+
+	table->count = count;
+	table->text_length = table->entries[count].offset;
+	rebuild_index(table, table->index_mask + 1);
+}
+
+void atom_release(AtomTable *table)
+{
+	free(table->text);
+	free(table->entries);
+	free(table->index);
+	memset(table, 0, sizeof(*table));
+}
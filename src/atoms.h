@@ -0,0 +1,30 @@
+#ifndef ATOMS_H
+#define ATOMS_H
+#include <stdbool.h>
+#include <stddef.h>
+#ifndef __cplusplus
+typedef struct AtomEntry AtomEntry;
+#endif
+
+// Interned identifier, equal names get equal atoms. 0 is no atom.
+typedef int Atom;
+
+typedef struct {
+	char      *text;     // the names, each terminated by '\0'
+	size_t     text_length;
+	size_t     text_capacity;
+	AtomEntry *entries;  // indexed by atom
+	int        count;    // atoms handed out + 1
+	int        capacity;
+	int       *index;    // hash index of the entries, 0 for a free slot
+	int        index_mask;
+} AtomTable;
+
+Atom        atom_intern(AtomTable *table, const char *name, int length);
+// Valid until the next atom_intern
+const char *atom_name(const AtomTable *table, Atom atom);
+int         atom_count(const AtomTable *table);
+void        atom_truncate(AtomTable *table, int count); // forgets the later atoms
+void        atom_release(AtomTable *table);
+
+#endif // ATOMS_H
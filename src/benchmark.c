@@ -0,0 +1,355 @@
+#include "compiler.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compile-throughput benchmark on generated programs. Each workload stresses
+ * one part of the compiler and is generated at doubling sizes. The time per
+ * line should stay flat as a program grows, a cost growing faster than the
+ * program shows up as a rising 'cost' column.
+ *
+ * The sources are lexed ahead (pretokenized), so the scanner is timed on
+ * its own. Parsing and code generation are a single pass and timed
+ * together.
+ */
+
+// Deterministic numbers, so every run generates the same programs
+static unsigned g_seed;
+
+static int random_below(int n)
+{
+	g_seed = g_seed * 1103515245u + 12345u;
+	return (int)((g_seed >> 16) % (unsigned)n);
+}
+
+static const char *const Vars[] = {"a", "b", "c", "d"};
+
+// An integer expression over a, b, c and d, nested 'depth' levels. Right
+// operands are nested one level less than left ones, so a few registers do.
+static void generate_expression(Text *out, int depth)
+{
+	static const char *const Ops[] = {" + ", " - ", " * ", " div ", " mod "};
+
+	if (depth == 0) {
+		if (random_below(3) == 0)
+			text_printf(out, "%d", 1 + random_below(99));
+		else
+			text_printf(out, "%s", Vars[random_below(4)]);
+
+		return;
+	}
+
+	text_printf(out, "(");
+	generate_expression(out, depth - 1);
+	text_printf(out, "%s", Ops[random_below(3 + 2 * (depth == 1))]);
+	generate_expression(out, depth > 1 ? depth - 2 : 0);
+	text_printf(out, ")");
+}
+
+// Many constants and variables in one scope, each used once
+static void generate_declarations(Text *out, int size)
+{
+	text_printf(out, "module declarations;\n\nconst\n");
+
+	for (int i = 0; i < size; i++)
+		text_printf(out, "C%d = %d;\n", i, i);
+
+	text_printf(out, "\nvar\n");
+
+	for (int i = 0; i < size; i += 4)
+		text_printf(out, "v%d, v%d, v%d, v%d : integer;\n", i, i + 1, i + 2, i + 3);
+
+	text_printf(out, "\nbegin\n");
+
+	for (int i = 0; i < size; i += 4)
+		text_printf(out, "\tv%d := C%d + v%d;\n", i, random_below(size), random_below(size));
+
+	text_printf(out, "\tv0 := 0\nend declarations.\n");
+}
+
+// Procedures with parameters and locals, each calling the one before
+static void generate_procedures(Text *out, int size)
+{
+	text_printf(out, "module procedures;\n\nvar\nr : integer;\n\n");
+
+	for (int i = 0; i < size; i++) {
+		text_printf(out, "procedure p%d (x : integer; var y : integer);\n", i);
+		text_printf(out, "\tvar k, m : integer;\nbegin\n\tk := x * %d;\n", 2 + i % 7);
+		text_printf(out, "\tm := k + y;\n");
+		text_printf(out, "\tif m > 10 then y := m - 10 else y := m end");
+
+		if (i > 0)
+			text_printf(out, ";\n\tp%d(k, y)", i - 1);
+
+		text_printf(out, "\nend p%d;\n\n", i);
+	}
+
+	text_printf(out, "begin\n\tp%d(1, r)\nend procedures.\n", size - 1);
+}
+
+// Deep arithmetic and boolean expressions
+static void generate_expressions(Text *out, int size)
+{
+	text_printf(out, "module expressions;\n\nvar\na, b, c, d : integer;\n\nbegin\n");
+
+	for (int i = 0; i < size; i++) {
+		if (i % 4 == 3) {
+			text_printf(out, "\tif (a < b) & (b # c) or ~(d = %d) then\n\t\ta := ", i);
+			generate_expression(out, 3);
+			text_printf(out, "\n\tend;\n");
+		} else {
+			text_printf(out, "\t%s := ", Vars[i % 4]);
+			generate_expression(out, 5);
+			text_printf(out, ";\n");
+		}
+	}
+
+	text_printf(out, "\ta := 0\nend expressions.\n");
+}
+
+// A record type with 'size' fields, each field accessed, and copies of
+// whole records
+static void generate_records(Text *out, int size)
+{
+	text_printf(out, "module records;\n\ntype\nWide = record\n");
+
+	for (int i = 0; i < size; i++)
+		text_printf(out, "\tf%d: integer%s\n", i, i + 1 < size ? ";" : "");
+
+	text_printf(out, "end;\n\nvar\nr, s : Wide;\nt : array 4 of Wide;\ni : integer;\n\nbegin\n");
+
+	for (int i = 0; i < size; i++) {
+		text_printf(out, "\tr.f%d := s.f%d + t[i].f%d;\n", i, random_below(size),
+		            random_below(size));
+
+		if (i % 64 == 63)
+			text_printf(out, "\tt[%d] := r;\n\ts := t[i];\n", i / 64 % 4);
+	}
+
+	text_printf(out, "\tr := s\nend records.\n");
+}
+
+// Long if-elsif chains, on constants, which become a dispatch, and on
+// variables
+static void generate_branches(Text *out, int size)
+{
+	text_printf(out, "module branches;\n\nvar\nx, y : integer;\n\nbegin\n");
+
+	for (int chain = 0; chain < 4; chain++) {
+		for (int i = 0; i < size / 4; i++) {
+			text_printf(out, i == 0 ? "\tif " : "\telsif ");
+
+			if (chain % 2 == 0)
+				text_printf(out, "x = %d then\n", i * (1 + chain));
+			else
+				text_printf(out, "x < y + %d then\n", i);
+
+			text_printf(out, "\t\ty := %d\n", i);
+		}
+
+		text_printf(out, "\telse\n\t\ty := 0\n\tend;\n");
+	}
+
+	text_printf(out, "\tx := 0\nend branches.\n");
+}
+
+// Big arrays indexed by constants and variables, small loops that are
+// unrolled and copies of whole arrays
+static void generate_arrays(Text *out, int size)
+{
+	int length = 16 * size;
+	text_printf(out, "module arrays;\n\nvar\na, b : array %d of integer;\n", length);
+	text_printf(out, "m : array 64 of array 64 of integer;\ni, j : integer;\n\nbegin\n");
+
+	for (int i = 0; i < size; i++) {
+		switch (i % 4) {
+		case 0:
+			text_printf(out, "\ta[%d] := b[%d] + a[i];\n", random_below(length),
+			            random_below(length));
+			break;
+
+		case 1:
+			text_printf(out, "\tm[i][j] := m[j][%d] * a[i + %d];\n", random_below(64),
+			            random_below(length / 2));
+			break;
+
+		case 2:
+			text_printf(out, "\tfor j := 0 to 7 do b[j + i] := a[j] end;\n");
+			break;
+
+		case 3:
+			text_printf(out, i % 64 == 3 ? "\ta := b;\n" : "\ti := a[i] mod %d;\n", length);
+			break;
+		}
+	}
+
+	text_printf(out, "\ti := 0\nend arrays.\n");
+}
+
+typedef struct {
+	const char *name;
+	void      (*generate)(Text *out, int size);
+	int         size; // at scale 1 in the first step
+} Workload;
+
+static const Workload Workloads[] = {
+	{"declarations", generate_declarations, 1024},
+	{"procedures",   generate_procedures,   256},
+	{"expressions",  generate_expressions,  512},
+	{"records",      generate_records,      256},
+	{"branches",     generate_branches,     512},
+	{"arrays",       generate_arrays,       1024},
+};
+
+typedef struct {
+	int runs;  // compilations of each program
+	int steps; // sizes of each workload, doubling
+	int scale; // of the sizes
+} Options;
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest rank of sorted samples
+static double percentile(const double *sorted, int count, int percent)
+{
+	int rank = (percent * count + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static int count_lines(const Text *text)
+{
+	int lines = 0;
+
+	for (size_t i = 0; i < text->length; i++)
+		lines += text->data[i] == '\n';
+
+	return lines;
+}
+
+static bool run_workload(CompilerContext *ctx, const Workload *workload, const Options *options)
+{
+	double *total = malloc(options->runs * sizeof(*total));
+	double *lex = malloc(options->runs * sizeof(*lex));
+	double *parse = malloc(options->runs * sizeof(*parse));
+	double first_cost = 0;
+	bool ok = true;
+
+	for (int step = 0; step < options->steps && ok; step++) {
+		int size = workload->size * options->scale << step;
+		Text source = {0};
+		g_seed = 1;
+		workload->generate(&source, size);
+		int lines = count_lines(&source);
+		long tokens = 0;
+
+		for (int run = 0; run < options->runs; run++) {
+			if (!compiler_compile(ctx, source.data)) {
+				printf("Error: %s: line %d: %s\n", workload->name, compiler_get_error_line(ctx),
+				       compiler_get_error(ctx));
+				ok = false;
+				break;
+			}
+
+			const CompilerStats *stats = compiler_get_stats(ctx);
+			tokens = stats->tokens;
+			lex[run] = stats->seconds[CP_LEX];
+			parse[run] = stats->seconds[CP_PARSE];
+			total[run] = 0;
+
+			for (int phase = 0; phase < CP_COUNT; phase++)
+				total[run] += stats->seconds[phase];
+		}
+
+		text_free(&source);
+
+		if (!ok)
+			break;
+
+		qsort(total, options->runs, sizeof(*total), compare_doubles);
+		qsort(lex, options->runs, sizeof(*lex), compare_doubles);
+		qsort(parse, options->runs, sizeof(*parse), compare_doubles);
+		double median = percentile(total, options->runs, 50);
+		double cost = median / lines;
+
+		if (step == 0)
+			first_cost = cost;
+
+		printf("%-12s %7d %8ld %8.3f %8.3f %8.3f %8.2f %8.2f %8.2f %8.2f %6.2f\n",
+		       workload->name, lines, tokens, median * 1e3,
+		       percentile(total, options->runs, 90) * 1e3,
+		       percentile(total, options->runs, 99) * 1e3,
+		       lines / median * 1e-6, tokens / median * 1e-6,
+		       tokens / percentile(lex, options->runs, 50) * 1e-6,
+		       tokens / percentile(parse, options->runs, 50) * 1e-6,
+		       cost / first_cost);
+	}
+
+	free(total);
+	free(lex);
+	free(parse);
+	return ok;
+}
+
+static int parse_count(const char *text, const char *what)
+{
+	int count = atoi(text);
+
+	if (count < 1) {
+		printf("Error: Bad %s %s.\n", what, text);
+		exit(EXIT_FAILURE);
+	}
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	Options options = {20, 4, 1};
+	bool selected[ARRAY_COUNT(Workloads)] = {false};
+	bool any_selected = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--runs=", 7) == 0) {
+			options.runs = parse_count(argv[i] + 7, "run count");
+		} else if (strncmp(argv[i], "--steps=", 8) == 0) {
+			options.steps = parse_count(argv[i] + 8, "step count");
+		} else if (strncmp(argv[i], "--scale=", 8) == 0) {
+			options.scale = parse_count(argv[i] + 8, "scale");
+		} else {
+			size_t k = 0;
+
+			while (k < ARRAY_COUNT(Workloads) && !string_equal(argv[i], Workloads[k].name))
+				k++;
+
+			if (k == ARRAY_COUNT(Workloads)) {
+				printf("Error: Unknown workload %s.\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+
+			selected[k] = true;
+			any_selected = true;
+		}
+	}
+
+	CompilerContext *ctx = compiler_create();
+	compiler_set_pretokenize(ctx, true);
+	bool ok = true;
+
+	printf("%-12s %7s %8s %8s %8s %8s %8s %8s %8s %8s %6s\n", "workload", "lines", "tokens",
+	       "p50 ms", "p90 ms", "p99 ms", "Mline/s", "Mtok/s", "lex", "parse", "cost");
+
+	for (size_t k = 0; k < ARRAY_COUNT(Workloads) && ok; k++) {
+		if (!any_selected || selected[k])
+			ok = run_workload(ctx, &Workloads[k], &options);
+	}
+
+	compiler_destroy(ctx);
+	return ok ? 0 : EXIT_FAILURE;
+}
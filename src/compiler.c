@@ -0,0 +1,185 @@
+#include "compiler.h"
+#include "context.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void *compiler_alloc(CompilerContext *ctx, size_t size)
+{
+	ctx->stats.bytes_allocated += size;
+	return arena_alloc(&ctx->arena, size);
+}
+
+ArenaMark compiler_mark(CompilerContext *ctx)
+{
+	return arena_mark(&ctx->arena);
+}
+
+void compiler_release(CompilerContext *ctx, ArenaMark mark)
+{
+	arena_release(&ctx->arena, mark);
+}
+
+double compiler_clock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static const int DefaultErrorLimit = 20;
+
+CompilerContext *compiler_create(void)
+{
+	CompilerContext *ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx)
+		return NULL;
+
+	// everything allocated up to here stays for all compilations
+	parse_init(ctx);
+	scanner_set_error_limit(ctx, DefaultErrorLimit);
+	ctx->compile_mark = arena_mark(&ctx->arena);
+	ctx->kept_atoms = atom_count(&ctx->scanner.atoms);
+	return ctx;
+}
+
+void compiler_destroy(CompilerContext *ctx)
+{
+	if (!ctx)
+		return;
+
+	arena_free(&ctx->arena);
+	parse_release(ctx);
+	scanner_release(ctx);
+	generator_release(ctx);
+	am_release(ctx);
+	free(ctx);
+}
+
+void compiler_set_unroll_factor(CompilerContext *ctx, int factor)
+{
+	assert(factor >= 1);
+	parse_set_unroll_factor(ctx, factor);
+}
+
+void compiler_set_pretokenize(CompilerContext *ctx, bool pretokenize)
+{
+	scanner_set_pretokenize(ctx, pretokenize);
+}
+
+void compiler_set_lex_threads(CompilerContext *ctx, int threads)
+{
+	assert(threads >= 1);
+	scanner_set_lex_threads(ctx, threads);
+}
+
+void compiler_set_error_limit(CompilerContext *ctx, int limit)
+{
+	assert(limit >= 1);
+	scanner_set_error_limit(ctx, limit);
+}
+
+void compiler_set_pipeline(CompilerContext *ctx, bool pipeline)
+{
+	scanner_set_pipeline(ctx, pipeline);
+	am_set_pipeline(ctx, pipeline);
+}
+
+// Waits for the threads of the pipeline, the parse phase ends here
+static void finish_compile(CompilerContext *ctx, double parse_start)
+{
+	CompilerStats *stats = &ctx->stats;
+	double finish_start = compiler_clock();
+	stats->seconds[CP_PARSE] = finish_start - parse_start - stats->seconds[CP_LEX];
+	scanner_finish(ctx);
+	am_finish(ctx);
+	stats->seconds[CP_FINISH] = compiler_clock() - finish_start;
+}
+
+bool compiler_compile(CompilerContext *ctx, const char *source)
+{
+	double start = compiler_clock();
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	arena_release(&ctx->arena, ctx->compile_mark);
+	atom_truncate(&ctx->scanner.atoms, ctx->kept_atoms);
+	am_init(ctx);
+	generator_init(ctx);
+	ctx->recover = NULL;
+	double parse_start = compiler_clock();
+	ctx->stats.seconds[CP_SETUP] = parse_start - start;
+
+	if (setjmp(ctx->abort) != 0) {
+		// scanner_mark_error
+		finish_compile(ctx, parse_start);
+		return false;
+	}
+
+	parse_program(ctx, source);
+	finish_compile(ctx, parse_start);
+	return !scanner_has_error(ctx);
+}
+
+int compiler_get_code_size(const CompilerContext *ctx)
+{
+	return ctx->code.line;
+}
+
+const char *compiler_get_code_line(const CompilerContext *ctx, int pc)
+{
+	assert(pc >= 0 && pc < ctx->code.line);
+	return ctx->code.out[pc];
+}
+
+int compiler_get_entry_point(const CompilerContext *ctx)
+{
+	return ctx->generator.entry_pc;
+}
+
+const char *compiler_get_error(const CompilerContext *ctx)
+{
+	return compiler_get_error_count(ctx) > 0 ? compiler_get_error_at(ctx, 0).message : NULL;
+}
+
+int compiler_get_error_line(const CompilerContext *ctx)
+{
+	return compiler_get_error_count(ctx) > 0 ? compiler_get_error_at(ctx, 0).line : 0;
+}
+
+int compiler_get_error_count(const CompilerContext *ctx)
+{
+	return ctx->scanner.diagnostics.count;
+}
+
+CompilerError compiler_get_error_at(const CompilerContext *ctx, int index)
+{
+	assert(index >= 0 && index < ctx->scanner.diagnostics.count);
+	const Diagnostic *diagnostic = &ctx->scanner.diagnostics.items[index];
+	CompilerError error = {diagnostic->line, diagnostic->column, diagnostic->message};
+	return error;
+}
+
+const CompilerStats *compiler_get_stats(const CompilerContext *ctx)
+{
+	return &ctx->stats;
+}
+
+const char *compiler_get_phase_name(CompilerPhase phase)
+{
+	static const char *Names[] = {
+		[CP_SETUP]  = "setup",
+		[CP_LEX]    = "lex",
+		[CP_PARSE]  = "parse",
+		[CP_FINISH] = "finish",
+	};
+
+	assert(phase >= 0 && phase < CP_COUNT);
+	return Names[phase];
+}
+
+const char *compiler_get_instruction_name(int kind)
+{
+	assert(kind >= 0 && kind < CompilerInstructionKinds);
+	return am_get_kind_name(kind);
+}
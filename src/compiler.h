@@ -0,0 +1,83 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+#include <stdbool.h>
+#ifndef __cplusplus
+typedef struct CompilerContext CompilerContext;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Library interface of the compiler. A context compiles one module at a
+// time; independent contexts may be used concurrently from several threads.
+CompilerContext *compiler_create(void);
+void             compiler_destroy(CompilerContext *ctx);
+void             compiler_set_unroll_factor(CompilerContext *ctx, int factor); // 1 disables
+// Lexes the whole source before parsing, off by default
+void             compiler_set_pretokenize(CompilerContext *ctx, bool pretokenize);
+// Threads lexing a large source in chunks when pretokenizing, 1 by default
+void             compiler_set_lex_threads(CompilerContext *ctx, int threads);
+// Errors reported before a compilation is given up, 20 by default
+void             compiler_set_error_limit(CompilerContext *ctx, int limit);
+// Lexes and formats the code on threads of their own, overlapping with
+// parsing, off by default
+void             compiler_set_pipeline(CompilerContext *ctx, bool pipeline);
+
+// An error of the last compilation, the column counts the characters of
+// the line up to the position from 1
+typedef struct {
+	int         line;
+	int         column;
+	const char *message;
+} CompilerError;
+
+// Compiles a zero terminated source text, returns false on an error. The
+// parser recovers from most errors, so several may be reported. The code
+// and the errors stay valid until the next compilation with the same
+// context.
+bool        compiler_compile(CompilerContext *ctx, const char *source);
+int         compiler_get_code_size(const CompilerContext *ctx);
+const char *compiler_get_code_line(const CompilerContext *ctx, int pc); // ends with '\n'
+const char *compiler_get_error(const CompilerContext *ctx);             // the first, NULL without
+int         compiler_get_error_line(const CompilerContext *ctx);
+int         compiler_get_entry_point(const CompilerContext *ctx); // pc of the module's statements
+int           compiler_get_error_count(const CompilerContext *ctx);
+CompilerError compiler_get_error_at(const CompilerContext *ctx, int index);
+
+// Phases of a compilation timed by the statistics. Without pretokenizing
+// the source is lexed while it is parsed, then the lexing counts as parsing.
+typedef enum {
+	CP_SETUP,  // resetting the context
+	CP_LEX,    // lexing the whole source ahead
+	CP_PARSE,  // parsing and generating the code
+	CP_FINISH, // waiting for the threads of the pipeline
+	CP_COUNT
+} CompilerPhase;
+
+// Kinds of instructions counted by the statistics: the operations of the
+// abstract machine, loads, stores, jumps, labels, input and output
+enum { CompilerInstructionKinds = 20 };
+
+// Counters of the last compilation, also of a failed one
+typedef struct {
+	double seconds[CP_COUNT]; // wall time of each phase
+	long   tokens;            // of the source, each counted once
+	long   symbols_declared;
+	long   symbols_looked_up; // identifiers found in the scopes
+	int    scope_depth;       // deepest nesting, the module is 1, records count
+	long   instructions[CompilerInstructionKinds]; // emitted, also if discarded again
+	long   fixups;            // instructions patched after they were emitted
+	int    registers;         // high-water mark of the register stack R
+	long   bytes_allocated;   // by the context for objects, types etc.
+} CompilerStats;
+
+const CompilerStats *compiler_get_stats(const CompilerContext *ctx);
+const char          *compiler_get_phase_name(CompilerPhase phase);
+const char          *compiler_get_instruction_name(int kind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMPILER_H
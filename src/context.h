@@ -0,0 +1,39 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+#include "compiler.h"
+#include "scanner.h"
+#include "parser.h"
+#include "generator.h"
+#include "abstract_machine.h"
+#include "arena.h"
+#include <setjmp.h>
+#include <stddef.h>
+#ifndef __cplusplus
+typedef struct CompilerContext CompilerContext;
+#endif
+
+// All state of a compilation. Every scanner_, parse_, generator_ and am_
+// function works on the context passed to it, so separate contexts can
+// compile on separate threads.
+struct CompilerContext {
+	Scanner       scanner;
+	Parser        parser;
+	Generator     generator;
+	AsmFile       code;
+	Arena         arena;        // see compiler_alloc
+	ArenaMark     compile_mark; // behind the universe, kept for all compiles
+	int           kept_atoms;   // the predeclared names
+	jmp_buf       abort;        // taken by scanner_mark_error
+	jmp_buf      *recover;      // innermost recovery point of the parser, or NULL
+	CompilerStats stats;        // of the compilation, counted by all parts
+};
+
+// Zeroed memory owned by the context, e.g. objects and types. It is
+// released when the next compilation starts or the context is destroyed,
+// or earlier by returning to a mark, e.g. at the end of a procedure.
+void     *compiler_alloc(CompilerContext *ctx, size_t size);
+ArenaMark compiler_mark(CompilerContext *ctx);
+void      compiler_release(CompilerContext *ctx, ArenaMark mark);
+double    compiler_clock(void); // monotonic seconds, for the statistics
+
+#endif // CONTEXT_H
@@ -0,0 +1,32 @@
+#include "diagnostics.h"
+#include <stdlib.h>
+
+void diagnostics_clear(Diagnostics *list)
+{
+	list->count = 0;
+}
+
+bool diagnostics_add(Diagnostics *list, int line, int column, const char *message)
+{
+	if (list->count >= list->capacity) {
+		list->capacity = list->capacity ? 2 * list->capacity : 8;
+		list->items = realloc(list->items, list->capacity * sizeof(*list->items));
+
+		if (!list->items)
+			abort(); // out of memory
+	}
+
+	Diagnostic *item = &list->items[list->count++];
+	item->line = line;
+	item->column = column;
+	string_copy(item->message, message);
+	return list->count < list->limit;
+}
+
+void diagnostics_release(Diagnostics *list)
+{
+	free(list->items);
+	list->items = NULL;
+	list->count = 0;
+	list->capacity = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+#include "utils.h"
+#include <stdbool.h>
+
+// An error found in the source
+typedef struct {
+	int  line;
+	int  column;
+	char message[MAX_STRLEN];
+} Diagnostic;
+
+// The errors of a compilation in the order they were found
+typedef struct {
+	Diagnostic *items;
+	int         count;
+	int         capacity;
+	int         limit; // the compilation is given up when it is reached
+} Diagnostics;
+
+void diagnostics_clear(Diagnostics *list); // keeps the limit
+// Returns false once the limit is reached
+bool diagnostics_add(Diagnostics *list, int line, int column, const char *message);
+void diagnostics_release(Diagnostics *list);
+
+#endif // DIAGNOSTICS_H
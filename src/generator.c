@@ -1,103 +1,221 @@
 #include "generator.h"
+#include "context.h"
 #include "objects.h"
 #include "types.h"
 #include "scanner.h"
 #include "abstract_machine.h"
 #include <assert.h>
 #include <memory.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 
-static int g_entry = 0;
-static int g_current_level = 0;
+void generator_init(CompilerContext *ctx)
+{
+	Generator *g = &ctx->generator;
+	g->R = 0;
+	g->current_level = 0;
+	g->entry_pc = -1;
+	g->frame_size = 0;
+	g->frame_top = 0;
+	g->frame_pc = -1;
+	g->patch_count = 1;
+}
+
+void generator_release(CompilerContext *ctx)
+{
+	Generator *g = &ctx->generator;
+	free(g->patch_nodes);
+	g->patch_nodes = NULL;
+	g->patch_capacity = 0;
+	g->patch_count = 1;
+}
+
+static PatchList append_patch(CompilerContext *ctx, PatchList jumps, int at)
+{
+	Generator *g = &ctx->generator;
+
+	if (g->patch_count >= g->patch_capacity) {
+		g->patch_capacity = g->patch_capacity ? 2 * g->patch_capacity : 256;
+		g->patch_nodes = realloc(g->patch_nodes,
+		                         g->patch_capacity * sizeof(*g->patch_nodes));
+	}
+
+	int node = g->patch_count++;
+	g->patch_nodes[node].at = at;
+	g->patch_nodes[node].next = 0;
+
+	if (jumps.first == 0)
+		jumps.first = node;
+	else
+		g->patch_nodes[jumps.last].next = node;
+
+	jumps.last = node;
+	return jumps;
+}
 
-int generator_get_current_level()
+static PatchList concat_patches(CompilerContext *ctx, PatchList head, PatchList tail)
 {
-	return g_current_level;
+	Generator *g = &ctx->generator;
+
+	if (head.first == 0)
+		return tail;
+
+	if (tail.first != 0) {
+		g->patch_nodes[head.last].next = tail.first;
+		head.last = tail.last;
+	}
+
+	return head;
 }
-int generator_get_program_counter()
+
+// Emits a conditional jump with an unknown destination
+static PatchList c_jump_forward(CompilerContext *ctx, ConditionCode cc, PatchList jumps)
 {
-	return am_get_pc();
+	if (cc == CC_FALSE) // never jumps, nothing to emit
+		return jumps;
+
+	am_emit_c_jump_im(ctx, cc, 0);
+	return append_patch(ctx, jumps, am_get_pc(ctx) - 1);
 }
-int generator_get_word_size()
+
+int generator_get_current_level(CompilerContext *ctx)
+{
+	return ctx->generator.current_level;
+}
+int generator_get_program_counter(CompilerContext *ctx)
+{
+	return am_get_pc(ctx);
+}
+void generator_discard_code(CompilerContext *ctx, int location)
+{
+	am_discard(ctx, location);
+}
+int generator_get_word_size(void)
 {
 	return 4;
 }
-void generator_increase_level(int delta)
+void generator_increase_level(CompilerContext *ctx, int delta)
 {
-	g_current_level += delta;
+	ctx->generator.current_level += delta;
 }
 
-static int R = 0;          // Current Register Index (Stack Machine)
 static const int GB = 13;  // Global Base Register
 static const int SP = 14;  // Stack Pointer Register
 static const int LNK = 15; // Link Register/Frame pointer
 static const int StackBase = 0xffffffc0; // initialize stack pointer
 
-static Item load(Item item)
+// Registers R0 up to 'count' - 1 are in use, for the statistics
+static void use_registers(CompilerContext *ctx, int count)
+{
+	if (count > ctx->stats.registers)
+		ctx->stats.registers = count;
+}
+
+// Pushes a register onto the stack R
+static void take_register(CompilerContext *ctx)
+{
+	ctx->generator.R += 1;
+	use_registers(ctx, ctx->generator.R);
+}
+
+static Item load(CompilerContext *ctx, Item item)
 {
+	Generator *g = &ctx->generator;
+
 	if (IM_REGISTER == item.mode)
 		return item;
 
 	if (IM_CONST == item.mode) {
-		am_emit_mov_im(R, item.konst.value);
+		am_emit_mov_im(ctx, g->R, item.konst.value);
 		item.mode = IM_REGISTER;
-		item.reg = R;
-		R += 1;
+		item.reg = g->R;
+		take_register(ctx);
 	} else if (IM_VAR == item.mode) {
-		am_emit_load(R, item.var.reg, item.var.offset);
+		am_emit_load(ctx, g->R, item.var.reg, item.var.offset);
 		item.mode = IM_REGISTER;
-		item.reg = R;
-		R += 1;
+		item.reg = g->R;
+		take_register(ctx);
 	} else if (IM_PARAMETER == item.mode) {
-		am_emit_load(R, item.parameter.reg, item.parameter.offset);
-		am_emit_load(R, R, 0);
+		am_emit_load(ctx, g->R, item.parameter.reg, item.parameter.offset);
+		am_emit_load(ctx, g->R, g->R, 0);
 		item.mode = IM_REGISTER;
-		item.reg = R;
-		R += 1;
+		item.reg = g->R;
+		take_register(ctx);
 	} else if (IM_REGISTER_INDIRECT == item.mode) {
 		int reg = item.reg_indirect.reg;
 		int offset = item.reg_indirect.offset;
-		am_emit_load(reg, reg, offset);
+		am_emit_load(ctx, reg, reg, offset);
 		item.mode = IM_REGISTER;
 		item.reg = reg;
+	} else if (IM_CONDITION == item.mode && !generator_has_jumps(item)) {
+		// no short circuit jumps, the flags decide alone
+		if (item.condition.cond_code == CC_TRUE)
+			am_emit_mov_im(ctx, g->R, 1);
+		else if (item.condition.cond_code == CC_FALSE)
+			am_emit_mov_im(ctx, g->R, 0);
+		else
+			am_emit_set(ctx, item.condition.cond_code, g->R);
+
+		item.mode = IM_REGISTER;
+		item.reg = g->R;
+		take_register(ctx);
 	} else if (IM_CONDITION == item.mode) {
-		am_emit_c_jump_im(negate_condition(item.condition.cond_code), 2);
-		generator_fix_links(item.condition.true_jump);
-		am_emit_mov_im(R, 1);
-		am_emit_jump_im(1);
-		generator_fix_links(item.condition.false_jump);
-		am_emit_mov_im(R, 0);
+		am_emit_c_jump_im(ctx, negate_condition(item.condition.cond_code), 2);
+		generator_fix_links(ctx, item.condition.true_jumps);
+		am_emit_mov_im(ctx, g->R, 1);
+		am_emit_jump_im(ctx, 1);
+		generator_fix_links(ctx, item.condition.false_jumps);
+		am_emit_mov_im(ctx, g->R, 0);
 		item.mode = IM_REGISTER;
-		item.reg = R;
-		R += 1;
+		item.reg = g->R;
+		take_register(ctx);
 	}
 
 	return item;
 }
 
-static Item load_address(Item item)
+static Item load_address(CompilerContext *ctx, Item item)
 {
+	Generator *g = &ctx->generator;
+
 	if (item.mode == IM_VAR) {
-		am_emit_add_im(R, item.var.reg, item.var.offset);
-		R += 1;
+		am_emit_add_im(ctx, g->R, item.var.reg, item.var.offset);
+		take_register(ctx);
 	} else if (item.mode == IM_PARAMETER) {
-		am_emit_load(R, item.parameter.reg, item.parameter.offset);
-		R += 1;
+		am_emit_load(ctx, g->R, item.parameter.reg, item.parameter.offset);
+		take_register(ctx);
 	} else if (item.mode == IM_REGISTER_INDIRECT) {
-		am_emit_add_im(item.reg_indirect.reg, item.reg_indirect.reg,
+		am_emit_add_im(ctx, item.reg_indirect.reg, item.reg_indirect.reg,
 		               item.reg_indirect.offset);
 	} else {
-		scanner_mark_error("address error");
+		scanner_mark_error(ctx, "address error");
 	}
 
 	item.mode = IM_REGISTER;
-	item.reg = R - 1;
+	item.reg = g->R - 1;
 	return item;
 }
 
-static Item load_condition(Item x)
+// A reference parameter holds the address of its actual parameter. Loading
+// that address once yields a register indirect item, so field offsets and
+// constant indices fold into the addressing mode like for plain variables.
+static Item load_reference(CompilerContext *ctx, Item item)
 {
+	Generator *g = &ctx->generator;
+	assert(item.mode == IM_PARAMETER);
+	am_emit_load(ctx, g->R, item.parameter.reg, item.parameter.offset);
+	item.mode = IM_REGISTER_INDIRECT;
+	item.reg_indirect.reg = g->R;
+	item.reg_indirect.offset = 0;
+	take_register(ctx);
+	return item;
+}
+
+static Item load_condition(CompilerContext *ctx, Item x)
+{
+	Generator *g = &ctx->generator;
+
 	if (x.type->form == TF_BOOL) {
 		if (x.mode == IM_CONST) {
 			if (x.konst.value)
@@ -107,127 +225,338 @@ static Item load_condition(Item x)
 
 			x.mode = IM_CONDITION;
 		} else {
-			x = load(x); // R += 1
-			am_emit_cmp_im(x.reg, 0);
-			R -= 1;
+			x = load(ctx, x); // R += 1
+			am_emit_cmp_im(ctx, x.reg, 0);
+			g->R -= 1;
 			x.mode = IM_CONDITION;
 			x.condition.cond_code = CC_NOT_EQUAL;
-			x.condition.false_jump = 0;
+			x.condition.false_jumps = (PatchList) {0};
+			x.condition.true_jumps = (PatchList) {0};
 		}
 	} else {
-		scanner_mark_error("bool?");
+		scanner_mark_error(ctx, "bool?");
 	}
 
 	return x;
 }
 
-void generator_store(Item x, Item y) // x := y
+// Structured assignments are copied word by word. Values of up to
+// BlockUnrollWords words are copied by straight-line code, larger ones by a
+// loop that moves BlockWidth words per iteration followed by the remainder.
+static const int BlockWidth = 4;
+static const int BlockUnrollWords = 8;
+
+static void copy_words(CompilerContext *ctx, int dest, int dest_offset, int src, int src_offset,
+                       int count)
+{
+	Generator *g = &ctx->generator;
+	int word_size = generator_get_word_size();
+
+	for (int i = 0; i < count; i += BlockWidth) {
+		int n = count - i < BlockWidth ? count - i : BlockWidth;
+
+		use_registers(ctx, g->R + n);
+
+		for (int k = 0; k < n; k++)
+			am_emit_load(ctx, g->R + k, src, src_offset + (i + k) * word_size);
+
+		for (int k = 0; k < n; k++)
+			am_emit_store(ctx, g->R + k, dest, dest_offset + (i + k) * word_size);
+	}
+}
+
+// Returns a register holding the address of a designator item.
+static int load_block_address(CompilerContext *ctx, Item item)
+{
+	Generator *g = &ctx->generator;
+
+	if (item.mode == IM_REGISTER_INDIRECT) {
+		if (item.reg_indirect.offset != 0)
+			am_emit_add_im(ctx, item.reg_indirect.reg, item.reg_indirect.reg,
+			               item.reg_indirect.offset);
+
+		return item.reg_indirect.reg;
+	}
+
+	assert(item.mode == IM_VAR);
+	am_emit_add_im(ctx, g->R, item.var.reg, item.var.offset);
+	take_register(ctx);
+	return g->R - 1;
+}
+
+static void store_block(CompilerContext *ctx, Item x, Item y) // x := y
+{
+	Generator *g = &ctx->generator;
+	assert(x.type == y.type);
+	int first = g->R;
+	int words = x.type->size / generator_get_word_size();
+
+	if (x.mode == IM_REGISTER_INDIRECT)
+		first -= 1;
+
+	if (y.mode == IM_REGISTER_INDIRECT)
+		first -= 1;
+
+	if (x.mode == IM_PARAMETER)
+		x = load_reference(ctx, x);
+
+	if (y.mode == IM_PARAMETER)
+		y = load_reference(ctx, y);
+
+	if (x.mode != IM_VAR && x.mode != IM_REGISTER_INDIRECT)
+		scanner_mark_error(ctx, "illegal assignment");
+
+	if (y.mode != IM_VAR && y.mode != IM_REGISTER_INDIRECT)
+		scanner_mark_error(ctx, "illegal assignment");
+
+	if (words <= BlockUnrollWords) {
+		copy_words(ctx, x.var.reg, x.var.offset, y.var.reg, y.var.offset, words);
+	} else {
+		int dest = load_block_address(ctx, x);
+		int src = load_block_address(ctx, y);
+		int counter = g->R;
+		take_register(ctx);
+		am_emit_mov_im(ctx, counter, words / BlockWidth);
+		int loop = am_get_pc(ctx);
+		copy_words(ctx, dest, 0, src, 0, BlockWidth);
+		am_emit_add_im(ctx, src, src, BlockWidth * generator_get_word_size());
+		am_emit_add_im(ctx, dest, dest, BlockWidth * generator_get_word_size());
+		am_emit_sub_im(ctx, counter, counter, 1);
+		am_emit_cmp_im(ctx, counter, 0);
+		am_emit_c_jump_im(ctx, CC_GREATER, loop - am_get_pc(ctx) - 1);
+		copy_words(ctx, dest, 0, src, 0, words % BlockWidth);
+	}
+
+	g->R = first;
+}
+
+void generator_store(CompilerContext *ctx, Item x, Item y) // x := y
 {
+	Generator *g = &ctx->generator;
+
+	if (x.type->form >= TF_ARRAY) {
+		store_block(ctx, x, y);
+		return;
+	}
+
 	if (y.mode != IM_REGISTER)
-		y = load(y);
+		y = load(ctx, y);
 
 	if (x.mode == IM_VAR) {
-		am_emit_store(y.reg, x.var.reg, x.var.offset);
-		R -= 1;
+		am_emit_store(ctx, y.reg, x.var.reg, x.var.offset);
+		g->R -= 1;
 	} else if (x.mode == IM_PARAMETER) {
-		am_emit_load(R, x.parameter.reg, x.parameter.offset);
-		am_emit_store(y.reg, R, 0);
-		R -= 1;
+		am_emit_load(ctx, g->R, x.parameter.reg, x.parameter.offset);
+		am_emit_store(ctx, y.reg, g->R, 0);
+		g->R -= 1;
 	} else if (x.mode == IM_REGISTER_INDIRECT) {
-		am_emit_store(y.reg, x.reg_indirect.reg, x.reg_indirect.offset);
-		R -= 2;
+		am_emit_store(ctx, y.reg, x.reg_indirect.reg, x.reg_indirect.offset);
+		g->R -= 2;
 	} else {
-		scanner_mark_error("illegal assignment");
+		scanner_mark_error(ctx, "illegal assignment");
 	}
 }
 
-static Item put_operation(Operation op, Item x, Item y)
+// x := condition ? y : z, both values are loaded and the flags of the
+// condition pick one of them without a branch
+void generator_select(CompilerContext *ctx, Item x, Item condition, Item y, Item z)
 {
+	Generator *g = &ctx->generator;
+
+	if (condition.mode != IM_CONDITION)
+		condition = load_condition(ctx, condition);
+
+	assert(!generator_has_jumps(condition));
+	y = load(ctx, y);
+	z = load(ctx, z);
+	am_emit_cmov(ctx, negate_condition(condition.condition.cond_code), y.reg, z.reg);
+	g->R -= 1;
+	generator_store(ctx, x, y);
+}
+
+static Item put_operation(CompilerContext *ctx, Operation op, Item x, Item y)
+{
+	Generator *g = &ctx->generator;
+
 	if (x.mode == IM_CONST) { // y.mode != IM_CONST
 		// test range(x.a)
-		y = load(y);
+		y = load(ctx, y);
 
 		if (op == OP_SUB || op == OP_CMP || op == OP_DIV || op == OP_MOD) {
-			x = load(x);
-			R -= 1;
-			am_emit_operation(op, R - 1, x.reg, y.reg); // for OP_CMP R-1 arg is ignored
+			x = load(ctx, x);
+			g->R -= 1;
+			// for OP_CMP the R-1 arg is ignored
+			am_emit_operation(ctx, op, g->R - 1, x.reg, y.reg);
 		} else {
-			am_emit_operation_im(op, R - 1, y.reg, x.konst.value);
+			am_emit_operation_im(ctx, op, g->R - 1, y.reg, x.konst.value);
 		}
 	} else { // x.mode != IM_CONST
-		x = load(x);
+		x = load(ctx, x);
 
 		if (y.mode == IM_CONST) {
 			// test range(y.a)
-			am_emit_operation_im(op, R - 1, x.reg, y.konst.value);
+			am_emit_operation_im(ctx, op, g->R - 1, x.reg, y.konst.value);
 		} else {
-			y = load(y);
-			am_emit_operation(op, R - 2, x.reg, y.reg);
-			R -= 1;
+			y = load(ctx, y);
+			am_emit_operation(ctx, op, g->R - 2, x.reg, y.reg);
+			g->R -= 1;
 		}
 	}
 
 	x.mode = IM_REGISTER;
-	x.reg = R - 1;
+	x.reg = g->R - 1;
 	return x;
 }
 
-void generator_open()
+void generator_open(CompilerContext *ctx)
 {
+	Generator *g = &ctx->generator;
 	assert(false);
 	// TODO@Andreas: is this the entry point for a code module??
-	g_current_level = 0;
+	g->current_level = 0;
 	//g_program_counter = 0;
-	R = 0;
+	g->R = 0;
 	//put3(2, 7, 0); // jump
 	//put3(2, 7, 0); // jump here, used to reserve bytes
 	//g_program_counter = 8;
 	//first 16 words (32 bytes) in SRam reserved for boot loader
 }
 
-void generator_header(int size)
+void generator_header(CompilerContext *ctx, int size)
 {
-	//TODO@Andreas: Module begin?
-	//g_entry = am_get_pc();
-	//am_fix_jump(0, am_get_pc() - 1);
-	//am_emit_mov_im(GB, 0);
-	//am_emit_mov_im(SP, StackBase);
+	Generator *g = &ctx->generator;
+	g->frame_size = size;
+	g->frame_top = size;
+	g->frame_pc = -1;
+	g->entry_pc = am_get_pc(ctx);
+
+	//am_fix_jump(ctx, 0, am_get_pc(ctx) - 1);
+	//am_emit_mov_im(ctx, GB, 0);
+	//am_emit_mov_im(ctx, SP, StackBase);
 }
 
-void generator_close()
+void generator_close(void)
 {
 	//TODO@Andreas: Module end?
-	//am_emit_mov_im(0, 0);
-	//am_emit_jump(0);
-	//am_fix_jump(g_entry, (am_get_pc() + 7) / (8 * 32));
+	//am_emit_mov_im(ctx, 0, 0);
+	//am_emit_jump(ctx, 0);
+	//am_fix_jump(ctx, g_entry, (am_get_pc(ctx) + 7) / (8 * 32));
 }
 
-void generator_enter(int parblksize, int locblksize)
+void generator_enter(CompilerContext *ctx, int parblksize, int locblksize)
 {
+	Generator *g = &ctx->generator;
 	// TODO@Andreas: a = word size?
 	int a = 4;
 	int r = 0;
-	am_emit_label("ProcedureStart");
-	am_emit_sub_im(SP, SP, locblksize);
-	am_emit_store(LNK, SP, 0);
+	am_emit_label(ctx, "ProcedureStart");
+	g->frame_size = locblksize;
+	g->frame_top = locblksize;
+	g->frame_pc = am_get_pc(ctx);
+	am_emit_sub_im(ctx, SP, SP, locblksize);
+	am_emit_store(ctx, LNK, SP, 0);
 
 	while (a < parblksize) {
-		am_emit_store(r, SP, a);
+		am_emit_store(ctx, r, SP, a);
 		r += 1;
 		a += 4;
 	}
 }
 
-void generator_return(int size)
+void generator_return(CompilerContext *ctx, int size)
 {
-	am_emit_load(LNK, SP, 0);
-	am_emit_add_im(SP, SP, size);
-	am_emit_jump(LNK);
-	am_emit_label("ProcedureEnd");
+	Generator *g = &ctx->generator;
+	assert(size <= g->frame_size);
+
+	if (size != g->frame_size)
+		am_fix_operation_im(ctx, g->frame_pc, OP_SUB, SP, SP, g->frame_size);
+
+	am_emit_load(ctx, LNK, SP, 0);
+	am_emit_add_im(ctx, SP, SP, g->frame_size);
+	am_emit_jump(ctx, LNK);
+	am_emit_label(ctx, "ProcedureEnd");
 }
 
 
-Item generator_field(Item record, Object *field) // x := x.y
+static Item make_hidden_item(CompilerContext *ctx)
+{
+	Generator *g = &ctx->generator;
+	Item item = {0};
+	item.mode = IM_VAR;
+	item.type = &IntType;
+	item.level = g->current_level;
+	item.var.reg = g->current_level == 0 ? GB : SP;
+	item.var.offset = g->frame_top;
+	g->frame_top += generator_get_word_size();
+
+	if (g->frame_top > g->frame_size)
+		g->frame_size = g->frame_top;
+
+	return item;
+}
+
+static void free_hidden_item(CompilerContext *ctx, Item item)
+{
+	Generator *g = &ctx->generator;
+	g->frame_top -= generator_get_word_size();
+	assert(item.var.offset == g->frame_top);
+}
+
+// The loop is rotated: the condition is tested once in front of the body
+// and then by a fused increment, compare and branch behind it.
+Item generator_for_limit(CompilerContext *ctx, Item limit)
+{
+	if (limit.mode == IM_CONST)
+		return limit;
+
+	Item x = make_hidden_item(ctx);
+	generator_store(ctx, x, limit);
+	return x;
+}
+
+PatchList generator_for_enter(CompilerContext *ctx, Item x, Item start, Item limit, int step)
+{
+	PatchList exit_jumps = {0};
+
+	if (start.mode == IM_CONST && limit.mode == IM_CONST) {
+		if ((step > 0 && start.konst.value <= limit.konst.value)
+		    || (step < 0 && start.konst.value >= limit.konst.value))
+			return exit_jumps;
+
+		return generator_f_jump(ctx, exit_jumps); // the body is never executed
+	}
+
+	Item condition = generator_relation(ctx, step > 0 ? TK_LESS_EQUAL : TK_GREATER_EQUAL,
+	                                    x, limit);
+	condition = generator_cf_jump(ctx, condition);
+	return condition.condition.false_jumps;
+}
+
+void generator_for_step(CompilerContext *ctx, Item x, int step)
+{
+	Generator *g = &ctx->generator;
+	assert(x.mode == IM_VAR);
+	Item counter = load(ctx, x);
+	am_emit_add_im(ctx, counter.reg, counter.reg, step);
+	am_emit_store(ctx, counter.reg, x.var.reg, x.var.offset);
+	g->R -= 1;
+}
+
+void generator_for_exit(CompilerContext *ctx, Item x, Item limit, int step, int location)
+{
+	assert(x.mode == IM_VAR);
+	Item counter = load(ctx, x);
+	am_emit_add_im(ctx, counter.reg, counter.reg, step);
+	am_emit_store(ctx, counter.reg, x.var.reg, x.var.offset);
+	Item condition = generator_relation(ctx, step > 0 ? TK_GREATER : TK_LESS,
+	                                    counter, limit);
+	generator_cb_jump(ctx, condition, location);
+
+	if (limit.mode != IM_CONST)
+		free_hidden_item(ctx, limit);
+}
+
+Item generator_field(CompilerContext *ctx, Item record, Object *field) // x := x.y
 {
 	assert(record.type->form == TF_RECORD);
 
@@ -236,157 +565,201 @@ Item generator_field(Item record, Object *field) // x := x.y
 	} else if (IM_REGISTER_INDIRECT == record.mode) {
 		record.reg_indirect.offset += field->field.offset;
 	} else if (IM_PARAMETER == record.mode) {
-		assert(false);
-		am_emit_load(R, record.parameter.reg, record.parameter.offset);
-		record.mode = IM_REGISTER_INDIRECT;
-		record.reg_indirect.reg = R;
+		record = load_reference(ctx, record);
 		record.reg_indirect.offset = field->field.offset;
-		R += 1;
 	}
 
 	return record;
 }
 
-Item generator_array_index(Item array, Item index) // x := x[y]
+Item generator_array_index(CompilerContext *ctx, Item array, Item index) // x := x[y]
 {
+	Generator *g = &ctx->generator;
 	assert(array.type->form == TF_ARRAY);
 	int base_size = array.type->array.base->size;
 
 	if (index.mode == IM_CONST) {
 		if (index.konst.value < 0
-		    || index.konst.value >= array.type->array.len) {
-			scanner_mark_error("bad index");
+		    || (!type_is_open_array(array.type)
+		        && index.konst.value >= array.type->array.len)) {
+			scanner_mark_error(ctx, "bad index");
 		}
 
-		if (array.mode == IM_PARAMETER) {
-			assert(false);
-			am_emit_load(R, array.parameter.reg, array.parameter.offset);
-			array.mode = IM_REGISTER_INDIRECT;
-			array.reg_indirect.offset = 0;
-		}
+		if (array.mode == IM_PARAMETER)
+			array = load_reference(ctx, array);
 
 		array.reg_indirect.offset += index.konst.value * base_size;
 	} else {
 		if (index.mode != IM_REGISTER)
-			index = load(index);
+			index = load(ctx, index);
 
-		am_emit_mul_im(index.reg, index.reg, base_size);
+		am_emit_mul_im(ctx, index.reg, index.reg, base_size);
 
 		if (array.mode == IM_VAR) {
-			am_emit_add(index.reg, array.var.reg, index.reg);
+			am_emit_add(ctx, index.reg, array.var.reg, index.reg);
 			//int reg = array.var.reg;
 			int offset = array.var.offset;
 			array.mode = IM_REGISTER_INDIRECT;
 			array.reg_indirect.reg = index.reg;
 			array.reg_indirect.offset = offset;
 		} else if (array.mode == IM_PARAMETER) {
-			assert(false);
+			// R is free, the index occupies R - 1
+			am_emit_load(ctx, g->R, array.parameter.reg, array.parameter.offset);
+			am_emit_add(ctx, index.reg, g->R, index.reg);
+			array.mode = IM_REGISTER_INDIRECT;
+			array.reg_indirect.reg = index.reg;
+			array.reg_indirect.offset = 0;
 		} else if (array.mode == IM_REGISTER_INDIRECT) {
-			am_emit_add(array.reg_indirect.reg, array.reg_indirect.reg, index.reg);
-			R -= 1;
+			int reg = array.reg_indirect.reg;
+			am_emit_add(ctx, reg, reg, index.reg);
+			g->R -= 1;
 		}
 	}
 
 	return array;
 }
 
-Item generator_parameter(Item x, ObjectClass klass)
+Item generator_parameter(CompilerContext *ctx, Item x, ObjectClass klass)
 {
 	if (klass == OC_PARAMETER) {
-		x = load_address(x);
+		x = load_address(ctx, x);
 	} else {
-		x = load(x);
+		x = load(ctx, x);
 	}
 
 	return x;
 }
 
-void generator_call(Item x)
+// The length of an open array lives in the word behind its address, so it
+// is addressed like a variable and loaded only where it is used. Fixed
+// arrays have a constant length.
+Item generator_array_length(CompilerContext *ctx, Item array)
+{
+	Generator *g = &ctx->generator;
+	assert(array.type->form == TF_ARRAY);
+	Item length = {0};
+
+	if (type_is_open_array(array.type)) {
+		assert(array.mode == IM_PARAMETER);
+		length.mode = IM_VAR;
+		length.type = &IntType;
+		length.level = array.level;
+		length.var.reg = array.parameter.reg;
+		length.var.offset = array.parameter.offset + generator_get_word_size();
+	} else {
+		if (array.mode == IM_REGISTER_INDIRECT)
+			g->R -= 1; // address not needed
+
+		length = generator_make_const_item(TF_INT, array.type->array.len);
+	}
+
+	return length;
+}
+
+void generator_open_array_parameter(CompilerContext *ctx, Item x)
 {
+	assert(x.type->form == TF_ARRAY);
+	Item length = {0};
+
+	if (type_is_open_array(x.type))
+		length = generator_array_length(ctx, x);
+	else
+		length = generator_make_const_item(TF_INT, x.type->array.len);
+
+	load_address(ctx, x);
+	load(ctx, length);
+}
+
+void generator_call(CompilerContext *ctx, Item x)
+{
+	Generator *g = &ctx->generator;
+
 	if (x.mode == IM_PROCEDURE_CALL) {
 		// save LNK and jump = call
 		// put3(3, 7, x.a - g_program_counter - 1)
-		// R15 := PC + 1;
-		am_emit_mov_im(LNK, am_get_pc() + 1); // must be saved at runtime?
-		am_emit_jump_im(x.procedure_call.offset - am_get_pc() - 1);
+		// R15 := PC + 2, behind the jump
+		am_emit_mov_im(ctx, LNK, am_get_pc(ctx) + 2);
+		am_emit_jump_im(ctx, x.procedure_call.offset - am_get_pc(ctx) - 1);
 	} else {
 		assert(false); // BUILTIN_PROCEDURE_CALL?
-		x = load(x);
+		x = load(ctx, x);
 		// put3(1, 14, x.reg);
 		// R15 := PC + 1;
-		am_emit_mov_im(LNK, am_get_pc() + 1); // must be saved at runtime?
-		//am_emit_c_jump_reg(CC_GREATER, x.reg);
-		R -= 1;
+		am_emit_mov_im(ctx, LNK, am_get_pc(ctx) + 1); // must be saved at runtime?
+		//am_emit_c_jump_reg(ctx, CC_GREATER, x.reg);
+		g->R -= 1;
 	}
 
-	R = 0;
+	g->R = 0;
+}
+
+void generator_read(CompilerContext *ctx, Item x)
+{
+	Generator *g = &ctx->generator;
+	Item y = {0};
+	y.mode = IM_REGISTER;
+	y.type = &IntType;
+	y.reg = g->R;
+	am_emit_read(ctx, y.reg);
+	take_register(ctx);
+	generator_store(ctx, x, y);
 }
 
-Item generator_op1(int op, Item x) // x := op x
+void generator_write(CompilerContext *ctx, Item x)
+{
+	Generator *g = &ctx->generator;
+	x = load(ctx, x);
+	am_emit_write(ctx, x.reg);
+	g->R -= 1;
+}
+
+void generator_write_line(CompilerContext *ctx)
+{
+	am_emit_write_line(ctx);
+}
+
+Item generator_op1(CompilerContext *ctx, int op, Item x) // x := op x
 {
 	if (op == TK_MINUS) {
 		if (x.mode == IM_CONST) {
 			x.konst.value = -x.konst.value;
 		} else {
 			if (x.mode == IM_VAR)
-				x = load(x);
+				x = load(ctx, x);
 
-			am_emit_xor_im(x.reg, x.reg, -1);
-			am_emit_add_im(x.reg, x.reg, 1);
+			am_emit_xor_im(ctx, x.reg, x.reg, -1);
+			am_emit_add_im(ctx, x.reg, x.reg, 1);
 		}
 	} else if (op == TK_LOGIC_NOT) {
 		if (x.mode != IM_CONDITION)
-			x = load_condition(x);
+			x = load_condition(ctx, x);
 
 		x.condition.cond_code = negate_condition(x.condition.cond_code);
-		int tmp = x.condition.false_jump;
-		x.condition.false_jump = x.condition.true_jump;
-		x.condition.true_jump = tmp;
+		PatchList tmp = x.condition.false_jumps;
+		x.condition.false_jumps = x.condition.true_jumps;
+		x.condition.true_jumps = tmp;
 	} else if (op == TK_LOGIC_AND) {
 		if (x.mode != IM_CONDITION)
-			x = load_condition(x);
+			x = load_condition(ctx, x);
 
-		am_emit_c_jump_im(negate_condition(x.condition.cond_code),
-		                  x.condition.false_jump);
-		x.condition.false_jump = generator_get_program_counter() - 1;
-		generator_fix_links(x.condition.true_jump);
-		x.condition.true_jump = 0;
+		ConditionCode cc = negate_condition(x.condition.cond_code);
+		x.condition.false_jumps = c_jump_forward(ctx, cc, x.condition.false_jumps);
+		generator_fix_links(ctx, x.condition.true_jumps);
+		x.condition.true_jumps = (PatchList) {0};
 	} else if (op == TK_LOGIC_OR) {
 		if (x.mode != IM_CONDITION)
-			x = load_condition(x);
+			x = load_condition(ctx, x);
 
-		am_emit_c_jump_im(x.condition.cond_code, x.condition.true_jump);
-		x.condition.true_jump = generator_get_program_counter() - 1;
-		generator_fix_links(x.condition.false_jump);
-		x.condition.false_jump = 0;
+		ConditionCode cc = x.condition.cond_code;
+		x.condition.true_jumps = c_jump_forward(ctx, cc, x.condition.true_jumps);
+		generator_fix_links(ctx, x.condition.false_jumps);
+		x.condition.false_jumps = (PatchList) {0};
 	}
 
 	return x;
 }
 
-static int merged(int l0, int l1)
-{
-	if (l0 != 0) {
-		int l2 = l0;
-		int l3 = 0;
-
-		while (true) {
-			int l3 = am_get_jump_location(l2);
-
-			if (l3 == 0)
-				break;
-
-			l2 = l3;
-		}
-
-		am_fix_jump(l2, am_get_jump_location(l2) - l3 + l1);
-		l1 = l0;
-	}
-
-	return l1;
-}
-
-Item generator_op2(int op, Item x, Item y)
+Item generator_op2(CompilerContext *ctx, int op, Item x, Item y)
 {
 	if (x.type->form == TF_INT) {
 		Operation o = 0;
@@ -432,20 +805,22 @@ Item generator_op2(int op, Item x, Item y)
 
 			x.konst.value = result;
 		} else {
-			x = put_operation(o, x, y);
+			x = put_operation(ctx, o, x, y);
 		}
 	} else if (x.type->form == TF_BOOL) {
 		if (y.mode != IM_CONDITION) {
-			y = load_condition(y);
+			y = load_condition(ctx, y);
 		}
 
 		if (op == TK_LOGIC_OR) {
-			x.condition.false_jump = y.condition.false_jump;
-			x.condition.true_jump = merged(y.condition.true_jump, x.condition.true_jump);
+			x.condition.false_jumps = y.condition.false_jumps;
+			x.condition.true_jumps = concat_patches(ctx, y.condition.true_jumps,
+			                                        x.condition.true_jumps);
 			x.condition.cond_code = y.condition.cond_code;
 		} else if (op == TK_LOGIC_AND) {
-			x.condition.false_jump = merged(y.condition.false_jump, x.condition.false_jump);
-			x.condition.true_jump = y.condition.true_jump;
+			x.condition.false_jumps = concat_patches(ctx, y.condition.false_jumps,
+			                                         x.condition.false_jumps);
+			x.condition.true_jumps = y.condition.true_jumps;
 			x.condition.cond_code = y.condition.cond_code;
 		} else {
 			assert(false);
@@ -455,8 +830,9 @@ Item generator_op2(int op, Item x, Item y)
 	return x;
 }
 
-Item generator_relation(int op, Item x, Item y) // x := x ? y
+Item generator_relation(CompilerContext *ctx, int op, Item x, Item y) // x := x ? y
 {
+	Generator *g = &ctx->generator;
 	ConditionCode cc = 0;
 
 	switch (op) {
@@ -490,69 +866,192 @@ Item generator_relation(int op, Item x, Item y) // x := x ? y
 		assert(false);
 	}
 
-	x = put_operation(OP_CMP, x, y);
-	R -= 1;
+	x = put_operation(ctx, OP_CMP, x, y);
+	g->R -= 1;
 	x.mode = IM_CONDITION;
 	x.condition.cond_code = cc;
-	x.condition.false_jump = 0;
-	x.condition.true_jump = 0;
+	x.condition.false_jumps = (PatchList) {0};
+	x.condition.true_jumps = (PatchList) {0};
 	return x;
 }
 
-// Fixes the links stored already in the jmp instructions
-// with the current program_counter
-void generator_fix_links(int abs_location)
+// The selector of a case statement is loaded and the statements of all
+// cases follow a jump to the dispatch, which is emitted behind them once all
+// labels are known. The selector register is free again while the cases are
+// compiled, it is only live between the load and the dispatch.
+static const int CaseTableMinLabels = 4;
+static const int CaseTableDensity = 4;  // max table entries per label
+static const int CaseLinearLabels = 3;  // leaves of the decision tree
+
+PatchList generator_case_begin(CompilerContext *ctx, Item x)
+{
+	Generator *g = &ctx->generator;
+	x = load(ctx, x);
+	assert(x.reg == g->R - 1);
+	g->R -= 1;
+	return generator_f_jump(ctx, (PatchList) {0});
+}
+
+// Jumps to the case if the selector matches a label, else falls through.
+static void case_test(CompilerContext *ctx, int reg, CaseLabel label)
+{
+	if (label.low == label.high) {
+		am_emit_cmp_im(ctx, reg, label.low);
+		am_emit_c_jump_im(ctx, CC_EQUAL, label.location - am_get_pc(ctx) - 1);
+	} else {
+		am_emit_cmp_im(ctx, reg, label.low);
+		am_emit_c_jump_im(ctx, CC_LESS, 2);
+		am_emit_cmp_im(ctx, reg, label.high);
+		am_emit_c_jump_im(ctx, CC_LESS_EQUAL, label.location - am_get_pc(ctx) - 1);
+	}
+}
+
+// Binary decision tree over the sorted labels, adds the jumps taken if no
+// label matches
+static PatchList case_tree(CompilerContext *ctx, int reg, const CaseLabel *labels, int count,
+                           PatchList miss)
+{
+	if (count <= CaseLinearLabels) {
+		for (int i = 0; i < count; i++)
+			case_test(ctx, reg, labels[i]);
+
+		return generator_f_jump(ctx, miss);
+	}
+
+	int half = count / 2;
+	am_emit_cmp_im(ctx, reg, labels[half].low);
+	am_emit_c_jump_im(ctx, CC_LESS, 0);
+	int lower = am_get_pc(ctx) - 1;
+	miss = case_tree(ctx, reg, labels + half, count - half, miss);
+	am_fix_jump(ctx, lower, am_get_pc(ctx) - lower - 1);
+	return case_tree(ctx, reg, labels, half, miss);
+}
+
+static PatchList case_table(CompilerContext *ctx, int reg, const CaseLabel *labels, int count,
+                            PatchList miss)
+{
+	int low = labels[0].low;
+	int high = labels[count - 1].high;
+
+	if (low != 0)
+		am_emit_sub_im(ctx, reg, reg, low);
+
+	am_emit_cmp_im(ctx, reg, 0);
+	miss = c_jump_forward(ctx, CC_LESS, miss);
+	am_emit_cmp_im(ctx, reg, high - low);
+	miss = c_jump_forward(ctx, CC_GREATER, miss);
+	am_emit_add_im(ctx, reg, reg, am_get_pc(ctx) + 2); // absolute location of the table
+	am_emit_jump(ctx, reg);
+
+	for (int i = 0; i < count; i++) {
+		for (int value = labels[i].low; value <= labels[i].high; value++)
+			am_emit_jump_im(ctx, labels[i].location - am_get_pc(ctx) - 1);
+
+		// values between two labels
+		int next = i + 1 < count ? labels[i + 1].low : labels[i].high + 1;
+
+		for (int value = labels[i].high + 1; value < next; value++)
+			miss = generator_f_jump(ctx, miss);
+	}
+
+	return miss;
+}
+
+void generator_case_dispatch(CompilerContext *ctx, PatchList dispatch, const CaseLabel *labels,
+                             int count, int else_location)
 {
-	int l0 = abs_location; // the jump destination to fix
-	int l1 = 0;            // next jump destination to fix, saved at l0
+	Generator *g = &ctx->generator;
+	int reg = g->R;
+	PatchList miss = {0};
+	generator_fix_links(ctx, dispatch);
 
-	while (l0 != 0) {
-		l1 = am_get_jump_location(l0);
-		am_fix_jump(l0, am_get_pc() - l0 - 1);
-		l0 = l1;
+	if (count > 0) {
+		int span = labels[count - 1].high - labels[0].low + 1;
+
+		if (count >= CaseTableMinLabels && span / CaseTableDensity <= count)
+			miss = case_table(ctx, reg, labels, count, miss);
+		else
+			miss = case_tree(ctx, reg, labels, count, miss);
+	}
+
+	if (else_location >= 0) {
+		generator_fix_links(ctx, miss);
+		generator_b_jump(ctx, else_location);
+	} else {
+		generator_fix_links(ctx, miss); // no case matches, continue behind
 	}
 }
 
-Item generator_cf_jump(Item x)
+// Points all jumps of the list to location
+static void fix_patches(CompilerContext *ctx, PatchList jumps, int location)
+{
+	Generator *g = &ctx->generator;
+
+	for (int node = jumps.first; node != 0; node = g->patch_nodes[node].next) {
+		int at = g->patch_nodes[node].at;
+		am_fix_jump(ctx, at, location - at - 1);
+	}
+}
+
+// Fixes all jumps of the list to the current program_counter
+void generator_fix_links(CompilerContext *ctx, PatchList jumps)
+{
+	fix_patches(ctx, jumps, am_get_pc(ctx));
+}
+
+bool generator_has_jumps(Item x)
+{
+	return x.mode == IM_CONDITION
+	       && (x.condition.false_jumps.first != 0 || x.condition.true_jumps.first != 0);
+}
+
+Item generator_cf_jump(CompilerContext *ctx, Item x)
 {
 	if (x.mode != IM_CONDITION)
-		x = load_condition(x);
+		x = load_condition(ctx, x);
 
-	am_emit_c_jump_im(negate_condition(x.condition.cond_code),
-	                  x.condition.false_jump);
-	generator_fix_links(x.condition.true_jump);
-	x.condition.false_jump = am_get_pc() - 1;
+	ConditionCode cc = negate_condition(x.condition.cond_code);
+	x.condition.false_jumps = c_jump_forward(ctx, cc, x.condition.false_jumps);
+	generator_fix_links(ctx, x.condition.true_jumps);
+	x.condition.true_jumps = (PatchList) {0};
 	return x;
 }
 
-Item generator_cb_jump(Item x, int location)
+Item generator_cb_jump(CompilerContext *ctx, Item x, int location)
 {
 	if (x.mode != IM_CONDITION)
-		x = load_condition(x);
+		x = load_condition(ctx, x);
+
+	fix_patches(ctx, x.condition.false_jumps, location);
 
-	am_emit_c_jump_im(negate_condition(x.condition.cond_code),
-	                  location - am_get_pc() - 1);
+	am_emit_c_jump_im(ctx, negate_condition(x.condition.cond_code),
+	                  location - am_get_pc(ctx) - 1);
+
+	generator_fix_links(ctx, x.condition.true_jumps);
+	x.condition.false_jumps = (PatchList) {0};
+	x.condition.true_jumps = (PatchList) {0};
 	return x;
 }
 
-int generator_f_jump(int location)
+PatchList generator_f_jump(CompilerContext *ctx, PatchList jumps)
 {
-	am_emit_jump_im(location);
-	int abs_location = am_get_pc() - 1;
-	return abs_location;
+	am_emit_jump_im(ctx, 0);
+	return append_patch(ctx, jumps, am_get_pc(ctx) - 1);
 }
 
-void generator_b_jump(int location)
+void generator_b_jump(CompilerContext *ctx, int location)
 {
-	am_emit_jump_im(location - am_get_pc() - 1); // relative location
+	am_emit_jump_im(ctx, location - am_get_pc(ctx) - 1); // relative location
 }
 
-Item generator_make_item(Object *obj)
+Item generator_make_item(CompilerContext *ctx, Object *obj)
 {
+	Generator *g = &ctx->generator;
 	Item item = {0};
 	item.mode = (ItemMode)obj->klass;
 	item.type = obj->type;
 	item.level = obj->level;
+	item.read_only = obj->read_only;
 
 	if (item.mode == IM_CONST) {
 		item.konst.value = obj->konst.value;
@@ -561,31 +1060,32 @@ Item generator_make_item(Object *obj)
 
 		if (obj->level == 0)
 			item.var.reg = GB;
-		else if (obj->level == g_current_level)
+		else if (obj->level == g->current_level)
 			item.var.reg = SP;
 		else
-			scanner_mark_error("level!");
+			scanner_mark_error(ctx, "level!");
 	} else if (item.mode == IM_PARAMETER) {
 		item.parameter.offset = obj->parameter.address_offset;
 
 		if (obj->level == 0)
 			item.parameter.reg = GB;
-		else if (obj->level == g_current_level)
+		else if (obj->level == g->current_level)
 			item.parameter.reg = SP;
 		else
-			scanner_mark_error("level!");
+			scanner_mark_error(ctx, "level!");
 	} else if (item.mode == IM_PROCEDURE_CALL) {
 		item.procedure_call.offset = obj->procedure.entry_point_offset;
 
 		if (obj->level == 0)
 			item.procedure_call.reg = GB;
-		else if (obj->level == g_current_level)
+		else if (obj->level == g->current_level)
 			item.procedure_call.reg = SP;
 		else
-			scanner_mark_error("level!");
+			scanner_mark_error(ctx, "level!");
 	} else {
 		//disallow builtin procedure calls for now...
-		assert(false);
+		assert(item.mode != IM_BUILTIN_PROCEDURE_CALL);
+		scanner_mark_error(ctx, "not a value");
 	}
 
 	return item;
@@ -607,9 +1107,20 @@ Item generator_make_const_item(TypeForm form, int value)
 	return item;
 }
 
-void generator_check_registers()
+void generator_check_registers(CompilerContext *ctx)
 {
-	if (R != 0) {
-		scanner_mark_error("Expression crashed RegisterStack. Not in sync.");
+	Generator *g = &ctx->generator;
+
+	if (g->R != 0) {
+		scanner_mark_error(ctx, "Expression crashed RegisterStack. Not in sync.");
 	}
 }
+
+// After an error the parser continues with a later statement or
+// declaration, at 'level'
+void generator_recover(CompilerContext *ctx, int level)
+{
+	Generator *g = &ctx->generator;
+	g->R = 0;
+	g->current_level = level;
+}
@@ -7,6 +7,11 @@
 #ifndef __cplusplus
 typedef struct Item Item;
 typedef enum ItemMode ItemMode;
+typedef struct CaseLabel CaseLabel;
+typedef struct PatchList PatchList;
+typedef struct PatchNode PatchNode;
+typedef struct Generator Generator;
+typedef struct CompilerContext CompilerContext;
 #endif
 
 // must be in sync with ObjectClass
@@ -21,10 +26,41 @@ enum ItemMode {
 	IM_CONDITION
 };
 
+// Forward jumps whose destination is not known yet. The nodes are kept by
+// the generator, {0, 0} is the empty list so zeroed items have no jumps.
+struct PatchList {
+	int first;
+	int last;
+};
+
+// Nodes of all patch lists, node 0 terminates a list
+struct PatchNode {
+	int at;   // location of the jump
+	int next; // next node of the list
+};
+
+struct Generator {
+	int R;             // current register index (stack machine)
+	int current_level;
+	int entry_pc;      // where the statements of the module start, -1 before
+
+	// Hidden words are allocated behind the declared variables of the
+	// current frame. The frame size is only final at the end of a
+	// procedure, so the prologue is fixed up there.
+	int frame_size; // including hidden words
+	int frame_top;  // end of the hidden words in use
+	int frame_pc;   // prologue allocating the frame
+
+	PatchNode *patch_nodes;
+	int        patch_count;
+	int        patch_capacity;
+};
+
 struct Item {
 	ItemMode mode;
 	Type    *type;
 	int      level;
+	bool     read_only;
 
 	//int a, r; // all beneath could be reduced to this
 
@@ -61,37 +97,63 @@ struct Item {
 
 		struct {
 			ConditionCode cond_code; // c - the condition
-			int false_jump; // a
-			int true_jump;  // b
+			PatchList false_jumps; // a
+			PatchList true_jumps;  // b
 		} condition;
 	};
 };
 
+// A label range of a case statement and the location of its statements
+struct CaseLabel {
+	int low;
+	int high;
+	int location;
+};
+
+void generator_init(CompilerContext *ctx);    // before every compilation
+void generator_release(CompilerContext *ctx);
 // Size of a pointer on the system
-int generator_get_word_size();
-int generator_get_program_counter();
-int generator_get_current_level();
-void generator_open();
-void generator_header(int size);
-void generator_close();
-void generator_enter(int parblksize, int locblksize);  // procedure entry
-void generator_return(int size);                       // procedure exit
-void generator_increase_level(int delta);
-Item generator_parameter(Item x, ObjectClass klass);   // push params of procedure call
-void generator_call(Item x);                           // call procedure
-void generator_store(Item x, Item y);                  // x := y;
-Item generator_array_index(Item array, Item index);    // x := x[y]
-Item generator_field(Item record, Object *field);      // x := x.y
-Item generator_op1(int op_token_kind, Item x);         // x := op x
-Item generator_op2(int op_token_kind, Item x, Item y); // x := x op y
-Item generator_relation(int op, Item x, Item y);       // x := x ? y
-Item generator_cf_jump(Item x);               // conditional forward jump
-int  generator_f_jump(int relative_location); // unconditional forward jump
-Item generator_cb_jump(Item x, int location); // conditional backward jump
-void generator_b_jump(int location);          // unconditional backward jump
-void generator_fix_links(int location);
-Item generator_make_item(Object *obj);
+int generator_get_word_size(void);
+int generator_get_program_counter(CompilerContext *ctx);
+void generator_discard_code(CompilerContext *ctx, int location); // no links may point behind location
+int generator_get_current_level(CompilerContext *ctx);
+void generator_open(CompilerContext *ctx);
+void generator_header(CompilerContext *ctx, int size);
+void generator_close(void);
+void generator_enter(CompilerContext *ctx, int parblksize, int locblksize); // procedure entry
+void generator_return(CompilerContext *ctx, int size);                      // procedure exit
+void generator_increase_level(CompilerContext *ctx, int delta);
+Item generator_parameter(CompilerContext *ctx, Item x, ObjectClass klass);  // push params of procedure call
+void generator_open_array_parameter(CompilerContext *ctx, Item x);          // push address and length
+Item generator_array_length(CompilerContext *ctx, Item array);              // len(x)
+void generator_call(CompilerContext *ctx, Item x);                          // call procedure
+void generator_read(CompilerContext *ctx, Item x);                          // read(x)
+void generator_write(CompilerContext *ctx, Item x);                         // write(x)
+void generator_write_line(CompilerContext *ctx);                            // writeln
+void generator_store(CompilerContext *ctx, Item x, Item y);                 // x := y;
+void generator_select(CompilerContext *ctx, Item x, Item c, Item y, Item z);// x := c ? y : z
+Item generator_array_index(CompilerContext *ctx, Item array, Item index);   // x := x[y]
+Item generator_field(CompilerContext *ctx, Item record, Object *field);     // x := x.y
+Item generator_op1(CompilerContext *ctx, int op_token_kind, Item x);        // x := op x
+Item generator_op2(CompilerContext *ctx, int op_token_kind, Item x, Item y);// x := x op y
+Item generator_relation(CompilerContext *ctx, int op, Item x, Item y);      // x := x ? y
+Item generator_cf_jump(CompilerContext *ctx, Item x);                 // conditional forward jump
+PatchList generator_f_jump(CompilerContext *ctx, PatchList jumps);    // unconditional forward jump
+Item generator_cb_jump(CompilerContext *ctx, Item x, int location);   // conditional backward jump
+void generator_b_jump(CompilerContext *ctx, int location);            // unconditional backward jump
+bool generator_has_jumps(Item x);                                     // short circuit jumps pending
+Item generator_for_limit(CompilerContext *ctx, Item limit);           // evaluate once
+PatchList generator_for_enter(CompilerContext *ctx, Item x, Item start, Item limit,
+                              int step);                              // entry test
+void generator_for_step(CompilerContext *ctx, Item x, int step);      // x := x + step
+void generator_for_exit(CompilerContext *ctx, Item x, Item limit, int step, int location);
+PatchList generator_case_begin(CompilerContext *ctx, Item x); // returns the jump to the dispatch
+void generator_case_dispatch(CompilerContext *ctx, PatchList dispatch, const CaseLabel *labels,
+                             int count, int else_location); // labels sorted, -1 no else
+void generator_fix_links(CompilerContext *ctx, PatchList jumps);
+Item generator_make_item(CompilerContext *ctx, Object *obj);
 Item generator_make_const_item(TypeForm form, int value);
-void generator_check_registers();
+void generator_check_registers(CompilerContext *ctx);
+void generator_recover(CompilerContext *ctx, int level); // see scanner_mark_error
 
 #endif
@@ -1,51 +1,331 @@
-#include "parser.h"
+#include "compiler.h"
+#include "utils.h"
+#include "server.h"
 #include <stdio.h>
 #include <memory.h>
 #include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+#include <pthread.h>
+#include <unistd.h>
 
-char *file_read_text(const char *filename)
+// One input file. The workers fill in the output, the main thread writes
+// the outputs in the order of the inputs as soon as they are done.
+typedef struct {
+	const char *path;
+	Text        output;
+	Text        stats;  // written to stderr
+	bool        ok;
+	bool        done;
+} Job;
+
+typedef enum {
+	STATS_NONE,
+	STATS_TEXT,
+	STATS_JSON, // an object per file and line
+} StatsFormat;
+
+typedef struct {
+	Job            *jobs;
+	int             count;
+	int             next;          // first job not taken by a worker
+	int             unroll_factor; // 0 keeps the default
+	bool            pretokenize;
+	int             lex_threads;   // 0 keeps the default
+	bool            pipeline;
+	int             error_limit;   // 0 keeps the default
+	StatsFormat     stats;
+	bool            headers;       // name the file in front of its output
+	pthread_mutex_t lock;
+	pthread_cond_t  job_done;
+} Batch;
+
+static double tokens_per_second(const CompilerStats *stats)
 {
-	FILE *file = fopen(filename, "rb");
+	double seconds = stats->seconds[CP_LEX] + stats->seconds[CP_PARSE];
+	return seconds > 0 ? stats->tokens / seconds : 0;
+}
 
-	if (!file) {
-		printf("Error: Could not open file %s.\n", filename);
-		exit(EXIT_FAILURE);
+static void write_stats_text(Text *out, const char *path, const CompilerStats *stats)
+{
+	text_printf(out, "%s: stats\n  time     ", path);
+
+	for (int i = 0; i < CP_COUNT; i++)
+		text_printf(out, "%s%s %.3f ms", i > 0 ? ", " : " ", compiler_get_phase_name(i),
+		            stats->seconds[i] * 1e3);
+
+	long instructions = 0;
+
+	for (int i = 0; i < CompilerInstructionKinds; i++)
+		instructions += stats->instructions[i];
+
+	text_printf(out, "\n  tokens    %ld, %.1f M/s\n", stats->tokens,
+	            tokens_per_second(stats) * 1e-6);
+	text_printf(out, "  symbols   %ld declared, %ld looked up, scope depth %d\n",
+	            stats->symbols_declared, stats->symbols_looked_up, stats->scope_depth);
+	text_printf(out, "  code      %ld instructions, %ld fix-ups, %d registers\n",
+	            instructions, stats->fixups, stats->registers);
+
+	for (int i = 0, n = 0; i < CompilerInstructionKinds; i++) {
+		if (stats->instructions[i] > 0)
+			text_printf(out, "%s%s %ld", n++ > 0 ? ", " : "            ",
+			            compiler_get_instruction_name(i), stats->instructions[i]);
 	}
 
-	fseek(file, 0, SEEK_END);
-	long length = ftell(file);
-	fseek(file, 0, SEEK_SET);
-	char *buffer = malloc(length + 1);
+	if (instructions > 0)
+		text_printf(out, "\n");
 
-	if (!buffer) {
-		printf("Error: Could not allocate buffer for file %s.\n", filename);
-		exit(EXIT_FAILURE);
+	text_printf(out, "  memory    %ld bytes allocated\n", stats->bytes_allocated);
+}
+
+static void write_json_string(Text *out, const char *string)
+{
+	text_printf(out, "\"");
+
+	for (const char *p = string; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			text_printf(out, "\\%c", *p);
+		else if ((unsigned char)*p < ' ')
+			text_printf(out, "\\u%04x", *p);
+		else
+			text_printf(out, "%c", *p);
 	}
 
-	fread(buffer, 1, length, file);
-	buffer[length] = 0;
-	fclose(file);
-	return buffer;
+	text_printf(out, "\"");
+}
+
+static void write_stats_json(Text *out, const char *path, bool ok, const CompilerStats *stats)
+{
+	text_printf(out, "{\"file\":");
+	write_json_string(out, path);
+	text_printf(out, ",\"ok\":%s,\"seconds\":{", ok ? "true" : "false");
+
+	for (int i = 0; i < CP_COUNT; i++)
+		text_printf(out, "%s\"%s\":%.9f", i > 0 ? "," : "", compiler_get_phase_name(i),
+		            stats->seconds[i]);
+
+	text_printf(out, "},\"tokens\":%ld,\"tokens_per_second\":%.0f", stats->tokens,
+	            tokens_per_second(stats));
+	text_printf(out, ",\"symbols_declared\":%ld,\"symbols_looked_up\":%ld",
+	            stats->symbols_declared, stats->symbols_looked_up);
+	text_printf(out, ",\"scope_depth\":%d,\"instructions\":{", stats->scope_depth);
+
+	for (int i = 0; i < CompilerInstructionKinds; i++)
+		text_printf(out, "%s\"%s\":%ld", i > 0 ? "," : "", compiler_get_instruction_name(i),
+		            stats->instructions[i]);
+
+	text_printf(out, "},\"fixups\":%ld,\"registers\":%d,\"bytes_allocated\":%ld}\n",
+	            stats->fixups, stats->registers, stats->bytes_allocated);
 }
 
-void file_free_text(char *text)
+static void compile_job(CompilerContext *ctx, Job *job, bool header, StatsFormat stats)
 {
-	free(text);
+	Text *out = &job->output;
+	FileText source;
+
+	if (header)
+		text_printf(out, "%s:\n", job->path);
+
+	if (!file_open_text(&source, job->path)) {
+		text_printf(out, "Error: Could not open file %s.\n", job->path);
+		job->ok = false;
+		return;
+	}
+
+	job->ok = compiler_compile(ctx, source.data);
+	file_close_text(&source);
+
+	if (stats == STATS_TEXT)
+		write_stats_text(&job->stats, job->path, compiler_get_stats(ctx));
+	else if (stats == STATS_JSON)
+		write_stats_json(&job->stats, job->path, job->ok, compiler_get_stats(ctx));
+
+	if (!job->ok) {
+		for (int i = 0; i < compiler_get_error_count(ctx); i++) {
+			CompilerError error = compiler_get_error_at(ctx, i);
+			text_printf(out, "%s:%d:%d: error: %s\n", job->path, error.line, error.column,
+			            error.message);
+		}
+
+		return;
+	}
+
+	for (int i = 0; i < compiler_get_code_size(ctx); i++)
+		text_printf(out, "%3d: %s", i, compiler_get_code_line(ctx, i));
 }
 
-void compile(const char *path)
+// Every worker keeps its own context for all the jobs it takes
+static void *worker(void *argument)
 {
-	char *source = file_read_text(path);
-	parse_program(source);
-	file_free_text(source);
+	Batch *batch = argument;
+	CompilerContext *ctx = compiler_create();
+
+	if (batch->unroll_factor > 0)
+		compiler_set_unroll_factor(ctx, batch->unroll_factor);
+
+	compiler_set_pretokenize(ctx, batch->pretokenize);
+
+	if (batch->lex_threads > 0)
+		compiler_set_lex_threads(ctx, batch->lex_threads);
+
+	compiler_set_pipeline(ctx, batch->pipeline);
+
+	if (batch->error_limit > 0)
+		compiler_set_error_limit(ctx, batch->error_limit);
+
+	while (true) {
+		pthread_mutex_lock(&batch->lock);
+		int index = batch->next < batch->count ? batch->next++ : -1;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (index < 0)
+			break;
+
+		Job *job = &batch->jobs[index];
+		compile_job(ctx, job, batch->headers, batch->stats);
+		pthread_mutex_lock(&batch->lock);
+		job->done = true;
+		pthread_cond_broadcast(&batch->job_done);
+		pthread_mutex_unlock(&batch->lock);
+	}
+
+	compiler_destroy(ctx);
+	return NULL;
+}
+
+// Compiles all jobs with 'threads' workers, returns false if one failed
+static bool run_batch(Batch *batch, int threads)
+{
+	pthread_t *workers = malloc(threads * sizeof(*workers));
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->job_done, NULL);
+
+	for (int i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, worker, batch);
+
+	bool ok = true;
+
+	for (int i = 0; i < batch->count; i++) {
+		Job *job = &batch->jobs[i];
+		pthread_mutex_lock(&batch->lock);
+
+		while (!job->done)
+			pthread_cond_wait(&batch->job_done, &batch->lock);
+
+		pthread_mutex_unlock(&batch->lock);
+
+		if (job->output.length > 0)
+			fwrite(job->output.data, 1, job->output.length, stdout);
+
+		if (job->stats.length > 0) {
+			fflush(stdout);
+			fwrite(job->stats.data, 1, job->stats.length, stderr);
+		}
+
+		text_free(&job->output);
+		text_free(&job->stats);
+		ok = ok && job->ok;
+	}
+
+	for (int i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_cond_destroy(&batch->job_done);
+	pthread_mutex_destroy(&batch->lock);
+	free(workers);
+	return ok;
+}
+
+static int parse_count(const char *text, const char *what)
+{
+	int count = atoi(text);
+
+	if (count < 1) {
+		printf("Error: Bad %s %s.\n", what, text);
+		exit(EXIT_FAILURE);
+	}
+
+	return count;
+}
+
+// Arguments with wildcards are expanded here too, e.g. if they were quoted
+// or the shell does not expand them.
+static void add_input(glob_t *inputs, const char *pattern)
+{
+	int flags = GLOB_NOCHECK | (inputs->gl_pathc > 0 ? GLOB_APPEND : 0);
+
+	if (glob(pattern, flags, NULL, inputs) != 0) {
+		printf("Error: Could not expand %s.\n", pattern);
+		exit(EXIT_FAILURE);
+	}
 }
 
-extern void print_file(void);
 int main(int argc, char **argv)
 {
-	compile("./tests/01sample.ob0");
-	print_file();
-	printf("Done compiling\n");
+	glob_t inputs = {0};
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	Batch batch = {0};
+	const char *socket_path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--unroll=", 9) == 0) {
+			batch.unroll_factor = parse_count(argv[i] + 9, "unroll factor");
+		} else if (strcmp(argv[i], "--pretokenize") == 0) {
+			batch.pretokenize = true;
+		} else if (strncmp(argv[i], "--lex-threads=", 14) == 0) {
+			batch.lex_threads = parse_count(argv[i] + 14, "thread count");
+			batch.pretokenize = true;
+		} else if (strncmp(argv[i], "--max-errors=", 13) == 0) {
+			batch.error_limit = parse_count(argv[i] + 13, "error limit");
+		} else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0) {
+			batch.stats = STATS_TEXT;
+		} else if (strcmp(argv[i], "--stats=json") == 0) {
+			batch.stats = STATS_JSON;
+		} else if (strcmp(argv[i], "--pipeline") == 0) {
+			batch.pipeline = true;
+		} else if (strcmp(argv[i], "--server") == 0) {
+			socket_path = "oberon0c.sock";
+		} else if (strncmp(argv[i], "--server=", 9) == 0) {
+			socket_path = argv[i] + 9;
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = parse_count(argv[++i], "thread count");
+		} else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+			threads = parse_count(argv[i] + 2, "thread count");
+		} else {
+			add_input(&inputs, argv[i]);
+		}
+	}
+
+	if (socket_path) {
+		globfree(&inputs);
+		ServerOptions options = {batch.unroll_factor, batch.pretokenize, batch.lex_threads,
+		                         batch.pipeline, batch.error_limit};
+		return server_run(socket_path, &options) ? 0 : EXIT_FAILURE;
+	}
+
+	if (inputs.gl_pathc == 0)
+		add_input(&inputs, "./tests/01sample.ob0");
+
+	batch.count = (int)inputs.gl_pathc;
+	batch.jobs = calloc(batch.count, sizeof(*batch.jobs));
+	batch.headers = batch.count > 1;
+
+	for (int i = 0; i < batch.count; i++)
+		batch.jobs[i].path = inputs.gl_pathv[i];
+
+	if (threads < 1)
+		threads = 1;
 
+	if (threads > batch.count)
+		threads = batch.count;
+
+	bool ok = run_batch(&batch, threads);
+	free(batch.jobs);
+	globfree(&inputs);
+
+	if (!ok)
+		exit(EXIT_FAILURE);
+
+	printf("Done compiling\n");
 	return 0;
 }
@@ -1,50 +1,94 @@
 #include "objects.h"
+#include "context.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
-Object *object_append(Object **list)
+Object *object_append(CompilerContext *ctx, Object *head)
 {
-	assert(list);
-	Object *obj = malloc(sizeof(*obj));
-	memset(obj, 0, sizeof(*obj));
+	assert(head && head->klass == OC_HEAD);
+	Object *obj = compiler_alloc(ctx, sizeof(*obj));
 
-	if (*list == NULL) {
-		*list = obj;
-		return obj;
-	}
+	if (head->head.last)
+		head->head.last->next = obj;
+	else
+		head->next = obj;
 
-	for (Object *it = *list; it; it = it->next) {
-		if (it->next == NULL) {
-			it->next = obj;
-			return obj;
-		}
-	}
-
-	// should never happen
-	return NULL;
+	head->head.last = obj;
+	return obj;
 }
 
-Object *object_insert(Object **list)
+Object *object_insert(CompilerContext *ctx, Object **list)
 {
 	assert(list);
-	Object *obj = malloc(sizeof(*obj));
-	memset(obj, 0, sizeof(*obj));
+	Object *obj = compiler_alloc(ctx, sizeof(*obj));
 	obj->next = *list;
 	(*list) = obj;
 	return obj;
 }
 
-Object *object_find(Object **list, const char *name)
+Object *object_find(Object **list, Atom name)
 {
 	assert(list);
 	assert(*list);
 
 	for (Object *it = *list; it; it = it->next) {
-		if (string_equal(it->name, name)) {
+		if (it->name == name) {
 			return it;
 		}
 	}
 
 	return NULL;
 }
+
+void symbols_reset(SymbolTable *symbols)
+{
+	if (symbols->bindings)
+		memset(symbols->bindings, 0, symbols->capacity * sizeof(*symbols->bindings));
+
+	symbols->depth = 0;
+}
+
+void symbols_release(SymbolTable *symbols)
+{
+	free(symbols->bindings);
+	symbols->bindings = NULL;
+	symbols->capacity = 0;
+	symbols->depth = 0;
+}
+
+void symbols_bind(SymbolTable *symbols, Object *obj)
+{
+	assert(obj->name > 0);
+
+	if (obj->name >= symbols->capacity) {
+		int capacity = symbols->capacity ? symbols->capacity : 256;
+
+		while (capacity <= obj->name)
+			capacity *= 2;
+
+		symbols->bindings = realloc(symbols->bindings, capacity * sizeof(*symbols->bindings));
+
+		if (!symbols->bindings)
+			abort(); // out of memory
+
+		memset(symbols->bindings + symbols->capacity, 0,
+		       (capacity - symbols->capacity) * sizeof(*symbols->bindings));
+		symbols->capacity = capacity;
+	}
+
+	obj->shadowed = symbols->bindings[obj->name];
+	obj->depth = symbols->depth;
+	symbols->bindings[obj->name] = obj;
+}
+
+void symbols_unbind_scope(SymbolTable *symbols, Object *head)
+{
+	for (Object *it = head->next; it; it = it->next)
+		symbols->bindings[it->name] = it->shadowed;
+}
+
+Object *symbols_lookup(const SymbolTable *symbols, Atom name)
+{
+	return name < symbols->capacity ? symbols->bindings[name] : NULL;
+}
@@ -1,11 +1,13 @@
 #ifndef OBJECTS_H
 #define OBJECTS_H
 #include "utils.h"
+#include "atoms.h"
 #include <stdbool.h>
 #ifndef __cplusplus
 typedef enum ObjectClass ObjectClass;
 typedef struct Object Object;
 typedef struct Type Type;
+typedef struct CompilerContext CompilerContext;
 #endif
 
 enum ObjectClass {
@@ -26,13 +28,18 @@ struct Object {
 	ObjectClass klass;
 	Object      *next;
 	Object      *parent;
-	Object      *child;
-	char        name[MAX_STRLEN];
+	Object      *shadowed; // declaration of the same name in an outer scope
+	Atom        name;
+	int         depth;     // of the scope, see SymbolTable
 	int         level;
 	bool        is_param;
+	bool        read_only; // structured value parameters are passed by reference
 	Type        *type;
 
 	union {
+		struct { // OC_HEAD
+			Object *last; // declared last, for appending
+		} head;
 		struct { // OC_CONST for bool and integer
 			int value;
 		} konst;
@@ -54,8 +61,23 @@ struct Object {
 	}/*as*/;
 };
 
-Object *object_insert(Object **list);
-Object *object_append(Object **list);
-Object *object_find(Object **list, const char *name);
+// Scoped symbol table over the atoms. The innermost declaration of a name
+// is found directly, the declarations it hides are chained through
+// Object.shadowed and come back when its scope is unbound.
+typedef struct {
+	Object **bindings; // indexed by atom
+	int      capacity;
+	int      depth;    // of the innermost open scope, 0 if none
+} SymbolTable;
+
+void    symbols_reset(SymbolTable *symbols); // unbinds everything
+void    symbols_release(SymbolTable *symbols);
+void    symbols_bind(SymbolTable *symbols, Object *obj); // in the innermost scope
+void    symbols_unbind_scope(SymbolTable *symbols, Object *head);
+Object *symbols_lookup(const SymbolTable *symbols, Atom name);
+
+Object *object_insert(CompilerContext *ctx, Object **list);
+Object *object_append(CompilerContext *ctx, Object *head); // keeps the order
+Object *object_find(Object **list, Atom name);
 
 #endif
@@ -3,99 +3,182 @@
 #include "types.h"
 #include "objects.h"
 #include "generator.h"
+#include "context.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <setjmp.h>
 
-TokenKind g_symbol;
-Object   *g_module_scope = NULL;
-Object   *g_current_scope = NULL;
+// FOR loops with a constant trip count are unrolled by parsing their body
+// again for every copy. The budget limits the code of all copies together.
+static const int DefaultUnrollFactor = 4;
+static const int UnrollBudget = 256; // instructions
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Helper Functions
 ////////////////////////////////////////////////////////////////////////////////
 
-static void next(void)
+static void next(CompilerContext *ctx)
 {
-	g_symbol = scanner_get();
+	ctx->parser.symbol = scanner_get(ctx);
+	ctx->parser.token += 1;
+	ctx->stats.tokens += 1;
 }
 
-static void sym_assert_then_next(TokenKind kind, const char *message)
+// Tokens read again after a restore are not counted twice in the stats
+typedef struct {
+	ScannerPosition scanner;
+	TokenKind       symbol;
+	int             token;
+	long            tokens;
+} ParserPosition;
+
+static void save_position(CompilerContext *ctx, ParserPosition *position)
 {
-	if (g_symbol == kind)
-		next();
-	else
-		scanner_mark_error(message);
+	scanner_save(ctx, &position->scanner);
+	position->symbol = ctx->parser.symbol;
+	position->token = ctx->parser.token;
+	position->tokens = ctx->stats.tokens;
 }
 
-static void open_scope(void)
+static void restore_position(CompilerContext *ctx, const ParserPosition *position)
 {
-	Object *obj = malloc(sizeof(*obj));
-	memset(obj, 0, sizeof(*obj));
+	scanner_restore(ctx, &position->scanner);
+	ctx->parser.symbol = position->symbol;
+	ctx->parser.token = position->token;
+	ctx->stats.tokens = position->tokens;
+}
 
-	if (g_current_scope != NULL)
-		g_current_scope->child = obj;
+// Where parsing continues after an error, see scanner_mark_error. The
+// scopes and the state of the generator are returned to what they were
+// when the recovery point was entered.
+typedef struct {
+	jmp_buf  buf;
+	jmp_buf *outer;
+	Object  *scope;
+	int      level;
+} Recovery;
 
+static void close_scope(CompilerContext *ctx);
+
+static void enter_recovery(CompilerContext *ctx, Recovery *recovery)
+{
+	recovery->outer = ctx->recover;
+	recovery->scope = ctx->parser.current_scope;
+	recovery->level = generator_get_current_level(ctx);
+	ctx->recover = &recovery->buf;
+}
+
+static void recover(CompilerContext *ctx, Recovery *recovery)
+{
+	ctx->recover = &recovery->buf;
+
+	while (ctx->parser.current_scope != recovery->scope)
+		close_scope(ctx);
+
+	generator_recover(ctx, recovery->level);
+}
+
+static void leave_recovery(CompilerContext *ctx, Recovery *recovery)
+{
+	ctx->recover = recovery->outer;
+}
+
+static void sym_assert_then_next(CompilerContext *ctx, TokenKind kind, const char *message)
+{
+	if (ctx->parser.symbol == kind)
+		next(ctx);
+	else
+		scanner_mark_error(ctx, message);
+}
+
+static void open_scope(CompilerContext *ctx)
+{
+	Object *obj = compiler_alloc(ctx, sizeof(*obj));
 	obj->klass = OC_HEAD;
-	obj->parent = g_current_scope;
+	obj->parent = ctx->parser.current_scope;
 	obj->next = NULL;
-	g_current_scope = obj;
+	ctx->parser.current_scope = obj;
+	ctx->parser.symbols.depth += 1;
+
+	// the universe is not counted, the module is at depth 1
+	if (ctx->parser.symbols.depth - 1 > ctx->stats.scope_depth)
+		ctx->stats.scope_depth = ctx->parser.symbols.depth - 1;
 }
 
-static void close_scope(void)
+static void close_scope(CompilerContext *ctx)
 {
-	g_current_scope = g_current_scope->parent;
+	symbols_unbind_scope(&ctx->parser.symbols, ctx->parser.current_scope);
+	ctx->parser.symbols.depth -= 1;
+	ctx->parser.current_scope = ctx->parser.current_scope->parent;
 }
 
-static Object *create_object(ObjectClass klass, const char *name)
+static Object *lookup_object(CompilerContext *ctx, Atom name)
 {
-	Object *obj = object_find(&g_current_scope, name);
+	return symbols_lookup(&ctx->parser.symbols, name);
+}
+
+static Object *create_object(CompilerContext *ctx, ObjectClass klass, Atom name)
+{
+	Object *obj = lookup_object(ctx, name);
 
-	if (obj == NULL) {
-		obj = object_append(&g_current_scope);
+	if (obj == NULL || obj->depth < ctx->parser.symbols.depth) {
+		obj = object_append(ctx, ctx->parser.current_scope);
 		obj->klass = klass;
-		string_copy(obj->name, name);
+		obj->name = name;
+		obj->type = &IntType; // until the declaration sets it, also if it has an error
+		symbols_bind(&ctx->parser.symbols, obj);
+		ctx->stats.symbols_declared += 1;
 		return obj;
 	}
 
-	scanner_mark_error("multiple definitions '%s'", name);
+	scanner_mark_error(ctx, "multiple definitions '%s'", scanner_atom_name(ctx, name));
 	return obj;
 }
 
-static Object *find_object(const char *name)
+static Object *find_object(CompilerContext *ctx, Atom name)
 {
-	for (Object *scope = g_current_scope; scope; scope = scope->parent) {
-		Object *obj = object_find(&scope, name);
+	Object *obj = lookup_object(ctx, name);
+	ctx->stats.symbols_looked_up += 1;
 
-		if (obj)
-			return obj;
-	}
+	if (obj == NULL)
+		scanner_mark_error(ctx, "undefined '%s'", scanner_atom_name(ctx, name));
 
-	scanner_mark_error("undefined '%s'", name);
-	return NULL;
+	return obj;
 }
 
-static Object *find_field(Object *fields_list, const char *name)
+static Object *find_field(Object *fields_list, Atom name)
 {
 	return object_find(&fields_list, name);
 }
 
-static bool check_int(Item item)
+// Open array parameters accept any array with the same element type.
+static bool is_parameter_compatible(Type *formal, Type *actual)
+{
+	if (formal == actual)
+		return true;
+
+	return type_is_open_array(formal)
+	       && actual->form == TF_ARRAY
+	       && formal->array.base == actual->array.base;
+}
+
+static bool check_int(CompilerContext *ctx, Item item)
 {
 	if (item.type == &IntType)
 		return true;
 
-	scanner_mark_error("not an int");
+	scanner_mark_error(ctx, "not an int");
 	return false;
 }
 
-static bool check_bool(Item item)
+static bool check_bool(CompilerContext *ctx, Item item)
 {
 	if (item.type == &BoolType)
 		return true;
 
-	scanner_mark_error("not a bool");
+	scanner_mark_error(ctx, "not a bool");
 	return false;
 }
 
@@ -104,161 +187,206 @@ static bool check_bool(Item item)
 /// Parser Rules
 ////////////////////////////////////////////////////////////////////////////
 
-static Item parse_expression(void);
+static Item parse_expression(CompilerContext *ctx);
 
-static Item parse_selector(Item x)
+static Item parse_selector(CompilerContext *ctx, Item x)
 {
-	while (g_symbol == TK_LEFT_BRACKET || g_symbol == TK_PERIOD) {
-		if (g_symbol == TK_LEFT_BRACKET) {
-			next();
-			Item index = parse_expression();
+	while (ctx->parser.symbol == TK_LEFT_BRACKET || ctx->parser.symbol == TK_PERIOD) {
+		if (ctx->parser.symbol == TK_LEFT_BRACKET) {
+			next(ctx);
+			Item index = parse_expression(ctx);
 
 			if (x.type->form == TF_ARRAY) {
-				check_int(index);
-				x = generator_array_index(x, index);
+				check_int(ctx, index);
+				x = generator_array_index(ctx, x, index);
 				x.type = x.type->array.base;
 			} else {
-				scanner_mark_error("not an array");
+				scanner_mark_error(ctx, "not an array");
 			}
 
-			sym_assert_then_next(TK_RIGHT_BRACKET, "]?");
-		} else if (g_symbol == TK_PERIOD) {
-			next();
+			sym_assert_then_next(ctx, TK_RIGHT_BRACKET, "]?");
+		} else if (ctx->parser.symbol == TK_PERIOD) {
+			next(ctx);
 
-			if (g_symbol == TK_IDENTIFIER) {
+			if (ctx->parser.symbol == TK_IDENTIFIER) {
 				if (x.type->form == TF_RECORD) {
-					Object *record_field = find_field(x.type->record.fields,
-					                                  scanner_get_identifier());
-					next();
+					Atom name = scanner_get_atom(ctx);
+					Object *record_field = find_field(x.type->record.fields, name);
+					next(ctx);
 
 					if (record_field != NULL) {
-						x = generator_field(x, record_field);
+						x = generator_field(ctx, x, record_field);
 						x.type = record_field->type;
 					}
 				} else {
-					scanner_mark_error("undef");
+					scanner_mark_error(ctx, "undef");
 				}
 			} else {
-				scanner_mark_error("ident?");
+				scanner_mark_error(ctx, "ident?");
 			}
 		} else {
-			scanner_mark_error("not a selector");
+			scanner_mark_error(ctx, "not a selector");
 		}
 	}
 
 	return x;
 }
 
-static Item parse_builtin_function(Item x, int function_number)
+static Item parse_builtin_function(CompilerContext *ctx, Item x, int function_number)
 {
-	if (g_symbol != TK_LEFT_PAREN) {
-		scanner_mark_error("param missing");
+	if (ctx->parser.symbol != TK_LEFT_PAREN) {
+		scanner_mark_error(ctx, "param missing");
 		x = generator_make_const_item(TF_INT, 0);
 		return x;
 	}
 
-	sym_assert_then_next(TK_LEFT_PAREN, "(?");
-	x = parse_expression();
+	sym_assert_then_next(ctx, TK_LEFT_PAREN, "(?");
+	x = parse_expression(ctx);
 	Item y = {0};
 
-	if (g_symbol == TK_COMMA) {
-		next();
-		y = parse_expression();
+	if (function_number == 5) {
+		if (x.type->form == TF_ARRAY)
+			x = generator_array_length(ctx, x);
+		else
+			scanner_mark_error(ctx, "not an array");
+
+		sym_assert_then_next(ctx, TK_RIGHT_PAREN, ")?");
+		return x;
+	}
+
+	if (ctx->parser.symbol == TK_COMMA) {
+		next(ctx);
+		y = parse_expression(ctx);
 	} else {
-		scanner_mark_error("command expected");
+		scanner_mark_error(ctx, "command expected");
 	}
 
 	if (function_number == 0) {
-		//x = generator_emit_get(x, y);
+		//x = generator_emit_get(ctx, x, y);
 	} else if (function_number == 1) {
-		//x = generator_emit_put(x, y);
+		//x = generator_emit_put(ctx, x, y);
 	} else if (function_number == 2) {
-		//x = generator_emit_ord(x);
+		//x = generator_emit_ord(ctx, x);
 	} else if (function_number == 3) {
-		//x = generator_odd(x);
+		//x = generator_odd(ctx, x);
 	} else if (function_number == 4) {
-		//x = generator_bit(x, y);
+		//x = generator_bit(ctx, x, y);
 	}
 
-	if (g_symbol == TK_RIGHT_PAREN)
-		next();
+	if (ctx->parser.symbol == TK_RIGHT_PAREN)
+		next(ctx);
 	else
-		scanner_mark_error("rparen expected");
+		scanner_mark_error(ctx, "rparen expected");
 
 	return x;
 }
 
-static Item parse_factor()
+// A statement calling a builtin procedure: read(v), write(x) or writeln.
+// get and put are parsed but generate no code.
+static void parse_builtin_procedure(CompilerContext *ctx, Object *obj)
+{
+	int function_number = obj->builtin_procedure.function_number;
+
+	if (obj->type != NULL) {
+		scanner_mark_error(ctx, "not a procedure");
+	} else if (function_number == 8) {
+		generator_write_line(ctx);
+	} else if (function_number == 6 || function_number == 7) {
+		sym_assert_then_next(ctx, TK_LEFT_PAREN, "(?");
+		Item x = parse_expression(ctx);
+		check_int(ctx, x);
+
+		if (function_number == 7) {
+			generator_write(ctx, x);
+		} else if (x.read_only || (x.mode != IM_VAR && x.mode != IM_PARAMETER
+		                           && x.mode != IM_REGISTER_INDIRECT)) {
+			scanner_mark_error(ctx, "variable?");
+		} else {
+			generator_read(ctx, x);
+		}
+
+		sym_assert_then_next(ctx, TK_RIGHT_PAREN, ")?");
+	} else {
+		Item x = {0};
+		parse_builtin_function(ctx, x, function_number);
+	}
+}
+
+static Item parse_factor(CompilerContext *ctx)
 {
 	Item item = {0};
 	Object *obj = NULL;
 
 	// sync block
-	if (g_symbol < TK_LEFT_PAREN) {
-		scanner_mark_error("ident?");
+	if (ctx->parser.symbol < TK_LEFT_PAREN) {
+		scanner_report_error(ctx, "ident?");
 
-		while (g_symbol < TK_LEFT_PAREN)
-			next();
+		while (ctx->parser.symbol < TK_LEFT_PAREN)
+			next(ctx);
 	}
 
-	if (g_symbol == TK_IDENTIFIER) {
-		obj = find_object(scanner_get_identifier());
-		next();
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		obj = find_object(ctx, scanner_get_atom(ctx));
+		next(ctx);
+
+		if (obj->type == NULL) // get, put and proper procedures
+			scanner_mark_error(ctx, "not a value");
 
 		if (obj->klass == OC_BUILTIN_PROCEDURE) {
 			// other builtin (these are true functions, which return a value)
-			item = parse_builtin_function(item, obj->builtin_procedure.function_number);
+			int function_number = obj->builtin_procedure.function_number;
+			item = parse_builtin_function(ctx, item, function_number);
 			item.type = obj->type;
 		} else {
-			item = generator_make_item(obj);
-			item = parse_selector(item);
+			item = generator_make_item(ctx, obj);
+			item = parse_selector(ctx, item);
 		}
-	} else if (g_symbol == TK_LITERAL_NUMBER) {
-		item = generator_make_const_item(TF_INT, scanner_get_number());
-		next();
-	} else if (g_symbol == TK_LEFT_PAREN) {
-		next();
-
-		if (g_symbol != TK_RIGHT_PAREN) {
-			item = parse_expression();
+	} else if (ctx->parser.symbol == TK_LITERAL_NUMBER) {
+		item = generator_make_const_item(TF_INT, scanner_get_number(ctx));
+		next(ctx);
+	} else if (ctx->parser.symbol == TK_LEFT_PAREN) {
+		next(ctx);
+
+		if (ctx->parser.symbol != TK_RIGHT_PAREN) {
+			item = parse_expression(ctx);
 		}
 
-		sym_assert_then_next(TK_RIGHT_PAREN, ")?");
-	} else if (g_symbol == TK_LOGIC_NOT) {
-		next();
-		item = parse_factor();
-		check_bool(item);
-		item = generator_op1(TK_LOGIC_NOT, item);
+		sym_assert_then_next(ctx, TK_RIGHT_PAREN, ")?");
+	} else if (ctx->parser.symbol == TK_LOGIC_NOT) {
+		next(ctx);
+		item = parse_factor(ctx);
+		check_bool(ctx, item);
+		item = generator_op1(ctx, TK_LOGIC_NOT, item);
 	} else {
-		scanner_mark_error("factor?");
-		item = generator_make_item(NULL); // insert guard?
+		scanner_mark_error(ctx, "factor?");
+		item = generator_make_item(ctx, NULL); // insert guard?
 	}
 
 	return item;
 }
 
 // when int -> mul and div
-static Item parse_term()
+static Item parse_term(CompilerContext *ctx)
 {
-	Item x = parse_factor();
+	Item x = parse_factor(ctx);
 
-	while (g_symbol >= TK_TIMES && g_symbol <= TK_LOGIC_AND) {
-		TokenKind op = g_symbol;
-		next();
+	while (ctx->parser.symbol >= TK_TIMES && ctx->parser.symbol <= TK_LOGIC_AND) {
+		TokenKind op = ctx->parser.symbol;
+		next(ctx);
 
 		if (op == TK_LOGIC_AND) {
-			check_bool(x);
-			x = generator_op1(op, x);
+			check_bool(ctx, x);
+			x = generator_op1(ctx, op, x);
 		} else {
-			check_int(x);
+			check_int(ctx, x);
 		}
 
-		Item y = parse_factor();
+		Item y = parse_factor(ctx);
 
 		if (x.type == y.type) {
-			x = generator_op2(op, x, y);
+			x = generator_op2(ctx, op, x, y);
 		} else {
-			scanner_mark_error("incompatible types");
+			scanner_mark_error(ctx, "incompatible types");
 		}
 	}
 
@@ -266,39 +394,39 @@ static Item parse_term()
 }
 
 // when int -> plus and minus
-static Item parse_simple_expression()
+static Item parse_simple_expression(CompilerContext *ctx)
 {
 	Item x;
 
-	if (g_symbol == TK_PLUS) {
-		next();
-		x = parse_term();
-		check_int(x);
-	} else if (g_symbol == TK_MINUS) {
-		next();
-		x = parse_term();
-		x = generator_op1(TK_MINUS, x);
+	if (ctx->parser.symbol == TK_PLUS) {
+		next(ctx);
+		x = parse_term(ctx);
+		check_int(ctx, x);
+	} else if (ctx->parser.symbol == TK_MINUS) {
+		next(ctx);
+		x = parse_term(ctx);
+		x = generator_op1(ctx, TK_MINUS, x);
 	} else {
-		x = parse_term();
+		x = parse_term(ctx);
 	}
 
-	while (g_symbol >= TK_PLUS && g_symbol <= TK_LOGIC_OR) {
-		TokenKind op = g_symbol;
-		next();
+	while (ctx->parser.symbol >= TK_PLUS && ctx->parser.symbol <= TK_LOGIC_OR) {
+		TokenKind op = ctx->parser.symbol;
+		next(ctx);
 
 		if (op == TK_LOGIC_OR) {
-			check_bool(x);
-			x = generator_op1(op, x);
+			check_bool(ctx, x);
+			x = generator_op1(ctx, op, x);
 		} else {
-			check_int(x);
+			check_int(ctx, x);
 		}
 
-		Item y = parse_term();
+		Item y = parse_term(ctx);
 
 		if (x.type == y.type) {
-			x = generator_op2(op, x, y);
+			x = generator_op2(ctx, op, x, y);
 		} else {
-			scanner_mark_error("incompatible types");
+			scanner_mark_error(ctx, "incompatible types");
 		}
 	}
 
@@ -306,19 +434,19 @@ static Item parse_simple_expression()
 }
 
 // relational only
-static Item parse_expression()
+static Item parse_expression(CompilerContext *ctx)
 {
-	Item x = parse_simple_expression();
+	Item x = parse_simple_expression(ctx);
 
-	if (g_symbol >= TK_EQUAL && g_symbol <= TK_GREATER_EQUAL) {
-		TokenKind op = g_symbol; // save operator
-		next();
-		Item y = parse_simple_expression();
+	if (ctx->parser.symbol >= TK_EQUAL && ctx->parser.symbol <= TK_GREATER_EQUAL) {
+		TokenKind op = ctx->parser.symbol; // save operator
+		next(ctx);
+		Item y = parse_simple_expression(ctx);
 
 		if (x.type == y.type)
-			x = generator_relation(op, x, y);
+			x = generator_relation(ctx, op, x, y);
 		else
-			scanner_mark_error("incompatible types");
+			scanner_mark_error(ctx, "incompatible types");
 
 		x.type = &BoolType;
 	}
@@ -326,135 +454,731 @@ static Item parse_expression()
 	return x;
 }
 
-static void parse_statement_sequence(void);
-static void parse_statement_if(void)
+static void parse_statement_sequence(CompilerContext *ctx);
+static int  parse_case_label(CompilerContext *ctx);
+
+typedef struct {
+	CaseLabel *labels;
+	int        count;
+	int        capacity;
+} CaseLabelList;
+
+static CaseLabel *append_case_label(CompilerContext *ctx, CaseLabelList *list, int low,
+                                    int high);
+static void finish_case(CompilerContext *ctx, PatchList dispatch, CaseLabelList *list,
+                        int else_location, bool first_wins);
+
+// Chains like 'if x = 1 then ... elsif x = 2 then ...' testing one integer
+// variable against constants are compiled like a case statement. They are
+// recognized by scanning ahead over the tokens of the whole statement.
+static const int IfChainMinCases = 4;
+
+static bool skip_equality_test(CompilerContext *ctx, Atom *variable)
+{
+	if (ctx->parser.symbol != TK_IDENTIFIER)
+		return false;
+
+	Object *obj = lookup_object(ctx, scanner_get_atom(ctx));
+
+	if (obj == NULL || (obj->klass != OC_VAR && obj->klass != OC_PARAMETER)
+	    || obj->type != &IntType)
+		return false;
+
+	if (*variable == 0)
+		*variable = scanner_get_atom(ctx);
+	else if (*variable != scanner_get_atom(ctx))
+		return false;
+
+	next(ctx);
+
+	if (ctx->parser.symbol != TK_EQUAL)
+		return false;
+
+	next(ctx);
+
+	if (ctx->parser.symbol == TK_MINUS)
+		next(ctx);
+
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		obj = lookup_object(ctx, scanner_get_atom(ctx));
+
+		if (obj == NULL || obj->klass != OC_CONST || obj->type != &IntType)
+			return false;
+	} else if (ctx->parser.symbol != TK_LITERAL_NUMBER) {
+		return false;
+	}
+
+	next(ctx);
+
+	if (ctx->parser.symbol != TK_KEY_THEN)
+		return false;
+
+	next(ctx);
+	return true;
+}
+
+static bool scan_if_statement(CompilerContext *ctx);
+
+// Returns the recorded decision for the 'if' at the current token, -1 if
+// there is none of this generation
+static int find_if_chain(CompilerContext *ctx)
+{
+	Parser *p = &ctx->parser;
+
+	if (p->token < p->if_chains_capacity && p->if_chains[p->token] >> 1 == p->generation)
+		return p->if_chains[p->token] & 1;
+
+	return -1;
+}
+
+static void record_if_chain(CompilerContext *ctx, int token, bool chain)
+{
+	Parser *p = &ctx->parser;
+
+	if (token >= p->if_chains_capacity) {
+		int capacity = p->if_chains_capacity ? 2 * p->if_chains_capacity : 1024;
+
+		while (capacity <= token)
+			capacity *= 2;
+
+		unsigned *if_chains = realloc(p->if_chains, capacity * sizeof(*if_chains));
+
+		if (!if_chains)
+			abort(); // out of memory
+
+		memset(if_chains + p->if_chains_capacity, 0,
+		       (capacity - p->if_chains_capacity) * sizeof(*if_chains));
+		p->if_chains = if_chains;
+		p->if_chains_capacity = capacity;
+	}
+
+	p->if_chains[token] = p->generation << 1 | chain;
+}
+
+// Stops at the 'elsif', 'else' or 'end' closing the sequence. The 'if'
+// statements on the way are decided, so none is scanned twice.
+static bool skip_statement_sequence(CompilerContext *ctx)
+{
+	int depth = 0;
+
+	while (true) {
+		if (ctx->parser.symbol == TK_KEY_IF) {
+			depth += 1;
+
+			if (find_if_chain(ctx) < 0) {
+				// continues inside the statement where the scan stopped
+				scan_if_statement(ctx);
+				continue;
+			}
+		} else if (ctx->parser.symbol == TK_KEY_WHILE || ctx->parser.symbol == TK_KEY_FOR
+		           || ctx->parser.symbol == TK_KEY_CASE || ctx->parser.symbol == TK_KEY_REPEAT) {
+			depth += 1;
+		} else if (ctx->parser.symbol == TK_KEY_END
+		           || ctx->parser.symbol == TK_KEY_UNTIL) {
+			if (depth == 0)
+				return ctx->parser.symbol == TK_KEY_END;
+
+			depth -= 1;
+		} else if (ctx->parser.symbol == TK_KEY_ELSEIF
+		           || ctx->parser.symbol == TK_KEY_ELSE) {
+			if (depth == 0)
+				return true;
+		} else if (ctx->parser.symbol == TK_EOF) {
+			return false;
+		}
+
+		next(ctx);
+	}
+}
+
+// Decides and records whether the 'if' at the current token is an
+// equality chain. The scan stops at the first condition or arm that does
+// not fit, somewhere inside the statement.
+static bool scan_if_statement(CompilerContext *ctx)
 {
-	assert(g_symbol == TK_KEY_IF);
-	next();
-	Item condition = parse_expression();
-	check_bool(condition);
+	int token = ctx->parser.token;
+	Atom variable = 0;
+	int cases = 0;
+	bool result = false;
+
+	while (ctx->parser.symbol == TK_KEY_IF || ctx->parser.symbol == TK_KEY_ELSEIF) {
+		next(ctx);
+
+		if (!skip_equality_test(ctx, &variable) || !skip_statement_sequence(ctx))
+			break;
+
+		cases += 1;
+
+		if (ctx->parser.symbol != TK_KEY_ELSEIF) {
+			result = cases >= IfChainMinCases;
+			break;
+		}
+	}
+
+	record_if_chain(ctx, token, result);
+	return result;
+}
+
+static bool is_equality_chain(CompilerContext *ctx)
+{
+	int known = find_if_chain(ctx);
+
+	if (known >= 0)
+		return known;
+
+	ParserPosition start;
+	save_position(ctx, &start);
+	bool result = scan_if_statement(ctx);
+	restore_position(ctx, &start);
+	return result;
+}
+
+static void parse_equality_chain(CompilerContext *ctx)
+{
+	PatchList dispatch = {0};
+	PatchList exit_jumps = {0};
+	CaseLabelList list = {0};
+
+	while (ctx->parser.symbol == TK_KEY_IF || ctx->parser.symbol == TK_KEY_ELSEIF) {
+		next(ctx);
+
+		if (dispatch.first == 0) {
+			Object *obj = find_object(ctx, scanner_get_atom(ctx));
+			Item x = generator_make_item(ctx, obj);
+			dispatch = generator_case_begin(ctx, x);
+		}
+
+		next(ctx);
+		sym_assert_then_next(ctx, TK_EQUAL, "=?");
+		int value = parse_case_label(ctx);
+		sym_assert_then_next(ctx, TK_KEY_THEN, "then?");
+		append_case_label(ctx, &list, value, value);
+		parse_statement_sequence(ctx);
+		exit_jumps = generator_f_jump(ctx, exit_jumps);
+	}
+
+	int else_location = -1;
+
+	if (ctx->parser.symbol == TK_KEY_ELSE) {
+		next(ctx);
+		else_location = generator_get_program_counter(ctx);
+		parse_statement_sequence(ctx);
+		exit_jumps = generator_f_jump(ctx, exit_jumps);
+	}
+
+	finish_case(ctx, dispatch, &list, else_location, true);
+	generator_fix_links(ctx, exit_jumps);
+	sym_assert_then_next(ctx, TK_KEY_END, "end?");
+}
+
+// 'if c then v := a else v := b end' with a simple variable v and
+// constants or simple variables a and b becomes a conditional move.
+static bool skip_simple_assignment(CompilerContext *ctx, Atom *variable)
+{
+	if (ctx->parser.symbol != TK_IDENTIFIER)
+		return false;
+
+	Object *obj = lookup_object(ctx, scanner_get_atom(ctx));
+
+	if (obj == NULL || obj->klass != OC_VAR || obj->read_only
+	    || obj->type->form >= TF_ARRAY)
+		return false;
+
+	if (*variable == 0)
+		*variable = scanner_get_atom(ctx);
+	else if (*variable != scanner_get_atom(ctx))
+		return false;
+
+	next(ctx);
+
+	if (ctx->parser.symbol != TK_ASSIGN)
+		return false;
+
+	next(ctx);
+
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		obj = lookup_object(ctx, scanner_get_atom(ctx));
+
+		if (obj == NULL || (obj->klass != OC_VAR && obj->klass != OC_CONST)
+		    || obj->type->form >= TF_ARRAY)
+			return false;
+	} else if (ctx->parser.symbol != TK_LITERAL_NUMBER) {
+		return false;
+	}
+
+	next(ctx);
+
+	if (ctx->parser.symbol == TK_SEMICOLON)
+		next(ctx);
+
+	return true;
+}
+
+static bool is_select_diamond(CompilerContext *ctx, Item condition)
+{
+	if (condition.mode == IM_CONST || generator_has_jumps(condition))
+		return false;
+
+	ParserPosition start;
+	save_position(ctx, &start);
+	Atom variable = 0;
+	bool result = false;
+
+	if (ctx->parser.symbol == TK_KEY_THEN) {
+		next(ctx);
+
+		if (skip_simple_assignment(ctx, &variable)
+		    && ctx->parser.symbol == TK_KEY_ELSE) {
+			next(ctx);
+			result = skip_simple_assignment(ctx, &variable)
+			         && ctx->parser.symbol == TK_KEY_END;
+		}
+	}
+
+	restore_position(ctx, &start);
+	return result;
+}
+
+static void parse_select_diamond(CompilerContext *ctx, Item condition)
+{
+	sym_assert_then_next(ctx, TK_KEY_THEN, "then?");
+	Item x = generator_make_item(ctx, find_object(ctx, scanner_get_atom(ctx)));
+	next(ctx);
+	sym_assert_then_next(ctx, TK_ASSIGN, ":=?");
+	Item y = parse_expression(ctx);
+
+	if (ctx->parser.symbol == TK_SEMICOLON)
+		next(ctx);
+
+	sym_assert_then_next(ctx, TK_KEY_ELSE, "else?");
+	next(ctx);
+	sym_assert_then_next(ctx, TK_ASSIGN, ":=?");
+	Item z = parse_expression(ctx);
+
+	if (ctx->parser.symbol == TK_SEMICOLON)
+		next(ctx);
+
+	if (x.type != y.type || x.type != z.type)
+		scanner_mark_error(ctx, "incompatible assignment");
+
+	generator_select(ctx, x, condition, y, z);
+	sym_assert_then_next(ctx, TK_KEY_END, "end?");
+}
+
+static void parse_statement_if(CompilerContext *ctx)
+{
+	assert(ctx->parser.symbol == TK_KEY_IF);
+
+	if (is_equality_chain(ctx)) {
+		parse_equality_chain(ctx);
+		return;
+	}
+
+	next(ctx);
+	Item condition = parse_expression(ctx);
+	check_bool(ctx, condition);
+
+	if (is_select_diamond(ctx, condition)) {
+		parse_select_diamond(ctx, condition);
+		return;
+	}
 	// execute a jump when the condition is 'false'
-	condition = generator_cf_jump(condition); // condition holds the current pc
-	sym_assert_then_next(TK_KEY_THEN, "then?");
-	parse_statement_sequence();
-	int abs_loc = 0;
+	condition = generator_cf_jump(ctx, condition); // condition holds the current pc
+	sym_assert_then_next(ctx, TK_KEY_THEN, "then?");
+	parse_statement_sequence(ctx);
+	PatchList exit_jumps = {0};
 
-	while (g_symbol == TK_KEY_ELSEIF) {
-		next();
+	while (ctx->parser.symbol == TK_KEY_ELSEIF) {
+		next(ctx);
 		// here we 'mark' the entry of the next elsif
-		abs_loc = generator_f_jump(abs_loc);
+		exit_jumps = generator_f_jump(ctx, exit_jumps);
 		// fix jump dest from cf_jump
-		generator_fix_links(condition.condition.false_jump);
-		condition = parse_expression();
-		check_bool(condition);
-		condition = generator_cf_jump(condition);
-		sym_assert_then_next(TK_KEY_THEN, "then?");
-		parse_statement_sequence();
-	}
-
-	if (g_symbol == TK_KEY_ELSE) {
-		next();
-		abs_loc = generator_f_jump(abs_loc); // jump simply to the 'end'
-		generator_fix_links(condition.condition.false_jump);
-		parse_statement_sequence();
+		generator_fix_links(ctx, condition.condition.false_jumps);
+		condition = parse_expression(ctx);
+		check_bool(ctx, condition);
+		condition = generator_cf_jump(ctx, condition);
+		sym_assert_then_next(ctx, TK_KEY_THEN, "then?");
+		parse_statement_sequence(ctx);
+	}
+
+	if (ctx->parser.symbol == TK_KEY_ELSE) {
+		next(ctx);
+		exit_jumps = generator_f_jump(ctx, exit_jumps); // jump simply to the 'end'
+		generator_fix_links(ctx, condition.condition.false_jumps);
+		parse_statement_sequence(ctx);
 	} else {
-		generator_fix_links(condition.condition.false_jump);
+		generator_fix_links(ctx, condition.condition.false_jumps);
 	}
 
-	generator_fix_links(abs_loc); // fix all forward jumps at once
-	sym_assert_then_next(TK_KEY_END, "end?");
+	generator_fix_links(ctx, exit_jumps); // fix all forward jumps at once
+	sym_assert_then_next(ctx, TK_KEY_END, "end?");
 }
 
-static void parse_statement_while(void)
+static void parse_statement_while(CompilerContext *ctx)
 {
-	assert(g_symbol == TK_KEY_WHILE);
-	next();
-	int location = generator_get_program_counter();
-	Item item = parse_expression();
-	check_bool(item);
-	item = generator_cf_jump(item);
-	sym_assert_then_next(TK_KEY_DO, "do?");
-	parse_statement_sequence();
-	generator_b_jump(location);
-	generator_fix_links(item.condition.false_jump);
-	sym_assert_then_next(TK_KEY_END, "end?");
+	assert(ctx->parser.symbol == TK_KEY_WHILE);
+	next(ctx);
+	int location = generator_get_program_counter(ctx);
+	Item item = parse_expression(ctx);
+	check_bool(ctx, item);
+	item = generator_cf_jump(ctx, item);
+	sym_assert_then_next(ctx, TK_KEY_DO, "do?");
+	parse_statement_sequence(ctx);
+	generator_b_jump(ctx, location);
+	generator_fix_links(ctx, item.condition.false_jumps);
+	sym_assert_then_next(ctx, TK_KEY_END, "end?");
 }
 
-static void parse_statement_repeat(void)
+static void parse_statement_repeat(CompilerContext *ctx)
 {
-	assert(g_symbol == TK_KEY_REPEAT);
-	next();
-	int location = generator_get_program_counter();
-	parse_statement_sequence();
+	assert(ctx->parser.symbol == TK_KEY_REPEAT);
+	next(ctx);
+	int location = generator_get_program_counter(ctx);
+	parse_statement_sequence(ctx);
+
+	if (ctx->parser.symbol == TK_KEY_UNTIL) {
+		next(ctx);
+		Item item = parse_expression(ctx);
+		check_bool(ctx, item);
+		item = generator_cb_jump(ctx, item, location);
+	} else {
+		scanner_mark_error(ctx, "missing until");
+		next(ctx);
+	}
+}
 
-	if (g_symbol == TK_KEY_UNTIL) {
-		next();
-		Item item = parse_expression();
-		check_bool(item);
-		item = generator_cb_jump(item, location);
+static void parse_statement_for(CompilerContext *ctx)
+{
+	assert(ctx->parser.symbol == TK_KEY_FOR);
+	next(ctx);
+
+	if (ctx->parser.symbol != TK_IDENTIFIER) {
+		scanner_mark_error(ctx, "ident?");
+		return;
+	}
+
+	Object *obj = find_object(ctx, scanner_get_atom(ctx));
+	next(ctx);
+	Item x = generator_make_item(ctx, obj);
+	check_int(ctx, x);
+
+	if (x.mode != IM_VAR || x.read_only)
+		scanner_mark_error(ctx, "for variable?");
+
+	sym_assert_then_next(ctx, TK_ASSIGN, ":=?");
+	Item start = parse_expression(ctx);
+	check_int(ctx, start);
+	generator_store(ctx, x, start);
+	sym_assert_then_next(ctx, TK_KEY_TO, "to?");
+	Item limit = parse_expression(ctx);
+	check_int(ctx, limit);
+	int step = 1;
+
+	if (ctx->parser.symbol == TK_KEY_BY) {
+		next(ctx);
+		Item item = parse_expression(ctx);
+		check_int(ctx, item);
+
+		if (item.mode != IM_CONST || item.konst.value == 0)
+			scanner_mark_error(ctx, "bad step");
+		else
+			step = item.konst.value;
+	}
+
+	sym_assert_then_next(ctx, TK_KEY_DO, "do?");
+	limit = generator_for_limit(ctx, limit);
+	PatchList exit_jumps = generator_for_enter(ctx, x, start, limit, step);
+	int location = generator_get_program_counter(ctx);
+	int trips = 0;
+
+	if (start.mode == IM_CONST && limit.mode == IM_CONST)
+		trips = (limit.konst.value - start.konst.value) / step + 1;
+
+	ParserPosition body;
+	save_position(ctx, &body);
+	// the control variable may not be changed by the body
+	obj->read_only = true;
+	int calls = ctx->parser.calls;
+	parse_statement_sequence(ctx);
+	calls = ctx->parser.calls - calls;
+
+	// after an error the code is dropped anyway
+	if (trips > 1 && ctx->parser.unroll_factor > 1 && !scanner_has_error(ctx)) {
+		// a store of the control variable precedes copies with calls
+		int body_size = generator_get_program_counter(ctx) - location + (calls > 0 ? 2 : 0);
+		int factor = body_size > 0 ? UnrollBudget / body_size : trips;
+
+		if (factor >= trips) {
+			// Every copy sees the control variable as a constant, so the
+			// first copy is compiled again too. Procedures called from the
+			// body read the variable from memory, so it is stored before
+			// each copy then.
+			generator_discard_code(ctx, location);
+			int address_offset = obj->var.address_offset;
+			obj->klass = OC_CONST;
+			unsigned generation = ctx->parser.generation;
+
+			for (int i = 0; i < trips; i++) {
+				int value = start.konst.value + i * step;
+
+				if (calls > 0 && i > 0)
+					generator_store(ctx, x, generator_make_const_item(TF_INT, value));
+
+				obj->konst.value = value;
+				ctx->parser.generation = ++ctx->parser.last_generation;
+				restore_position(ctx, &body);
+				parse_statement_sequence(ctx);
+			}
+
+			ctx->parser.generation = generation;
+			obj->klass = OC_VAR;
+			obj->var.address_offset = address_offset;
+			generator_store(ctx, x, generator_make_const_item(TF_INT,
+			                start.konst.value + trips * step));
+		} else {
+			if (factor > ctx->parser.unroll_factor)
+				factor = ctx->parser.unroll_factor;
+
+			if (factor < 1)
+				factor = 1;
+
+			// blocks of 'factor' copies followed by the remaining copies
+			int blocks = trips / factor;
+
+			for (int i = 1; i < factor; i++) {
+				generator_for_step(ctx, x, step);
+				restore_position(ctx, &body);
+				parse_statement_sequence(ctx);
+			}
+
+			if (blocks > 1) {
+				int last = start.konst.value + (blocks - 1) * factor * step;
+				Item limit = generator_make_const_item(TF_INT, last);
+				generator_for_exit(ctx, x, limit, step, location);
+			} else {
+				generator_for_step(ctx, x, step);
+			}
+
+			for (int i = 0; i < trips % factor; i++) {
+				restore_position(ctx, &body);
+				parse_statement_sequence(ctx);
+				generator_for_step(ctx, x, step);
+			}
+		}
 	} else {
-		scanner_mark_error("missing until");
-		next();
+		generator_for_exit(ctx, x, limit, step, location);
 	}
+
+	obj->read_only = false;
+	generator_fix_links(ctx, exit_jumps);
+	sym_assert_then_next(ctx, TK_KEY_END, "end?");
+}
+
+static int parse_case_label(CompilerContext *ctx)
+{
+	Item item = parse_expression(ctx);
+
+	if (item.mode != IM_CONST || item.type != &IntType) {
+		scanner_mark_error(ctx, "bad label");
+		return 0;
+	}
+
+	return item.konst.value;
+}
+
+static CaseLabel *append_case_label(CompilerContext *ctx, CaseLabelList *list, int low,
+                                    int high)
+{
+	if (list->count == list->capacity) {
+		// the old labels stay with the context until the compilation ends
+		CaseLabel *labels = list->labels;
+		list->capacity = list->capacity ? 2 * list->capacity : 16;
+		list->labels = compiler_alloc(ctx, list->capacity * sizeof(*list->labels));
+
+		if (list->count > 0)
+			memcpy(list->labels, labels, list->count * sizeof(*list->labels));
+	}
+
+	CaseLabel *label = &list->labels[list->count++];
+	label->low = low;
+	label->high = high;
+	label->location = generator_get_program_counter(ctx);
+	return label;
+}
+
+static int compare_case_labels(const void *a, const void *b)
+{
+	const CaseLabel *x = a;
+	const CaseLabel *y = b;
+
+	if (x->low != y->low)
+		return (x->low > y->low) - (x->low < y->low);
+
+	return (x->location > y->location) - (x->location < y->location);
+}
+
+// Emits the dispatch of a case statement. Labels of an if-elsif chain may
+// repeat, there the first case wins.
+static void finish_case(CompilerContext *ctx, PatchList dispatch, CaseLabelList *list,
+                        int else_location, bool first_wins)
+{
+	if (list->count > 1)
+		qsort(list->labels, list->count, sizeof(*list->labels), compare_case_labels);
+
+	int count = 0;
+
+	for (int i = 0; i < list->count; i++) {
+		if (count > 0 && list->labels[i].low <= list->labels[count - 1].high) {
+			if (!first_wins)
+				scanner_mark_error(ctx, "multiple case labels %d",
+				                   list->labels[i].low);
+
+			continue;
+		}
+
+		list->labels[count++] = list->labels[i];
+	}
+
+	generator_case_dispatch(ctx, dispatch, list->labels, count, else_location);
+}
+
+static void parse_statement_case(CompilerContext *ctx)
+{
+	assert(ctx->parser.symbol == TK_KEY_CASE);
+	next(ctx);
+	Item x = parse_expression(ctx);
+	check_int(ctx, x);
+	sym_assert_then_next(ctx, TK_KEY_OF, "of?");
+	PatchList dispatch = generator_case_begin(ctx, x);
+	PatchList exit_jumps = {0};
+	CaseLabelList list = {0};
+
+	while (true) {
+		if (ctx->parser.symbol != TK_BAR && ctx->parser.symbol != TK_KEY_ELSE
+		    && ctx->parser.symbol != TK_KEY_END) {
+			while (true) {
+				int low = parse_case_label(ctx);
+				int high = low;
+
+				if (ctx->parser.symbol == TK_UPTO) {
+					next(ctx);
+					high = parse_case_label(ctx);
+
+					if (high < low)
+						scanner_mark_error(ctx, "bad range");
+				}
+
+				append_case_label(ctx, &list, low, high);
+
+				if (ctx->parser.symbol == TK_COMMA)
+					next(ctx);
+				else
+					break;
+			}
+
+			sym_assert_then_next(ctx, TK_COLON, ":?");
+			parse_statement_sequence(ctx);
+			exit_jumps = generator_f_jump(ctx, exit_jumps);
+		}
+
+		if (ctx->parser.symbol == TK_BAR)
+			next(ctx);
+		else
+			break;
+	}
+
+	int else_location = -1;
+
+	if (ctx->parser.symbol == TK_KEY_ELSE) {
+		next(ctx);
+		else_location = generator_get_program_counter(ctx);
+		parse_statement_sequence(ctx);
+		exit_jumps = generator_f_jump(ctx, exit_jumps);
+	}
+
+	finish_case(ctx, dispatch, &list, else_location, false);
+	generator_fix_links(ctx, exit_jumps);
+	sym_assert_then_next(ctx, TK_KEY_END, "end?");
 }
 
 // assignment and procedure call
-static void parse_statement_identifier(void)
+static void parse_statement_identifier(CompilerContext *ctx)
 {
-	assert(g_symbol == TK_IDENTIFIER);
-	Object *obj = find_object(scanner_get_identifier());
-	next();
-	Item x = generator_make_item(obj);
-	x = parse_selector(x);
+	assert(ctx->parser.symbol == TK_IDENTIFIER);
+	Object *obj = find_object(ctx, scanner_get_atom(ctx));
+	next(ctx);
+
+	if (obj->klass == OC_BUILTIN_PROCEDURE) {
+		parse_builtin_procedure(ctx, obj);
+		return;
+	}
+
+	Item x = generator_make_item(ctx, obj);
+	x = parse_selector(ctx, x);
 
-	if (g_symbol == TK_ASSIGN) {
-		next();
-		Item y = parse_expression();
+	if (ctx->parser.symbol == TK_ASSIGN) {
+		next(ctx);
+		Item y = parse_expression(ctx);
+
+		if (x.read_only)
+			scanner_mark_error(ctx, "read-only");
 
 		if ((x.type->form == TF_BOOL || x.type->form == TF_INT)
 		    && x.type->form == y.type->form) {
 			// simple assignment
-			generator_store(x, y); // x := y
+			generator_store(ctx, x, y); // x := y
+		} else if (x.type->form >= TF_ARRAY && x.type == y.type
+		           && !type_is_open_array(x.type)) {
+			// block copy
+			generator_store(ctx, x, y); // x := y
 		} else {
-			scanner_mark_error("incompatible assignment");
+			scanner_mark_error(ctx, "incompatible assignment");
 		}
-	} else if (g_symbol == TK_EQUAL) {
-		scanner_mark_error(":= ?");
-		next();
-		parse_expression(); // silently discard...
+	} else if (ctx->parser.symbol == TK_EQUAL) {
+		scanner_mark_error(ctx, ":= ?");
+		next(ctx);
+		parse_expression(ctx); // silently discard...
 	} else if (x.mode == IM_PROCEDURE_CALL) {
 		Object *param = obj->parent;
 
-		if (g_symbol == TK_LEFT_PAREN) {
-			next();
+		if (ctx->parser.symbol == TK_LEFT_PAREN) {
+			next(ctx);
 
-			if (g_symbol == TK_RIGHT_PAREN) {
-				next();
+			if (ctx->parser.symbol == TK_RIGHT_PAREN) {
+				next(ctx);
 			} else {
 				while (true) {
-					Item param_ex = parse_expression();
-
-					if (param->is_param) {
-						if (param_ex.type == param->type) {
-							generator_parameter(param_ex, param->klass);
+					Item param_ex = parse_expression(ctx);
+
+					if (param && param->is_param) {
+						if (is_parameter_compatible(param->type, param_ex.type)) {
+							if (param_ex.read_only && !param->read_only
+							    && param->klass == OC_PARAMETER) {
+								scanner_mark_error(ctx, "read-only");
+							}
+
+							if (type_is_open_array(param->type))
+								generator_open_array_parameter(ctx, param_ex);
+							else
+								generator_parameter(ctx, param_ex, param->klass);
 						} else {
-							scanner_mark_error("bad param type");
+							scanner_mark_error(ctx, "bad param type");
 						}
 
 						param = param->next;
 					} else {
-						scanner_mark_error("too many parameters");
+						scanner_mark_error(ctx, "too many parameters");
 					}
 
-					if (g_symbol == TK_COMMA) {
-						next();
-					} else if (g_symbol == TK_RIGHT_PAREN) {
-						next();
+					if (ctx->parser.symbol == TK_COMMA) {
+						next(ctx);
+					} else if (ctx->parser.symbol == TK_RIGHT_PAREN) {
+						next(ctx);
 						break;
-					} else if (g_symbol >= TK_SEMICOLON) {
+					} else if (ctx->parser.symbol >= TK_SEMICOLON) {
 						break;
 					} else {
-						scanner_mark_error(") or , ?");
+						scanner_mark_error(ctx, ") or , ?");
 					}
 				}
 			}
@@ -462,444 +1186,556 @@ static void parse_statement_identifier(void)
 
 		// must be OC_PROCEDURE
 		if (obj->procedure.entry_point_offset < 0) {
-			scanner_mark_error("forward call not allowed");
+			scanner_mark_error(ctx, "forward call not allowed");
 		} else {
-			generator_call(x);
+			generator_call(ctx, x);
+			ctx->parser.calls++;
 
 			if (param && param->is_param) {
-				scanner_mark_error("too few parameters");
+				scanner_mark_error(ctx, "too few parameters");
 			}
 		}
-	} else if (x.mode == IM_BUILTIN_PROCEDURE_CALL) {
-		// only get and put should be called here...(this are procedures...)
-		parse_builtin_function(x, x.builtin_procedure_call.function_number);
 	} else if (obj->klass == OC_TYPE) {
-		scanner_mark_error("illegal assignment");
+		scanner_mark_error(ctx, "illegal assignment");
 	} else {
-		scanner_mark_error("statement");
+		scanner_mark_error(ctx, "statement");
 	}
 }
 
-static void parse_statement_sequence(void)
+static void parse_statement_sequence(CompilerContext *ctx)
 {
+	Recovery recovery;
+	enter_recovery(ctx, &recovery);
+
+	if (setjmp(recovery.buf) != 0) {
+		// skip the rest of the statement
+		recover(ctx, &recovery);
+
+		while ((ctx->parser.symbol < TK_SEMICOLON || ctx->parser.symbol > TK_KEY_UNTIL)
+		       && ctx->parser.symbol < TK_KEY_ARRAY)
+			next(ctx);
+	}
+
 	while (true) {
 		// sync
-		if (g_symbol < TK_IDENTIFIER) {
-			scanner_mark_error("statement?");
+		if (ctx->parser.symbol < TK_IDENTIFIER) {
+			scanner_report_error(ctx, "statement?");
 
 			do {
-				next();
-			} while (g_symbol < TK_IDENTIFIER);
+				next(ctx);
+			} while (ctx->parser.symbol < TK_IDENTIFIER);
 		}
 
-		if (g_symbol == TK_IDENTIFIER) {
-			parse_statement_identifier();
-		} else if (g_symbol == TK_KEY_IF) {
-			parse_statement_if();
-		} else if (g_symbol == TK_KEY_WHILE) {
-			parse_statement_while();
-		} else if (g_symbol == TK_KEY_REPEAT) {
-			parse_statement_repeat();
+		if (ctx->parser.symbol == TK_IDENTIFIER) {
+			parse_statement_identifier(ctx);
+		} else if (ctx->parser.symbol == TK_KEY_IF) {
+			parse_statement_if(ctx);
+		} else if (ctx->parser.symbol == TK_KEY_WHILE) {
+			parse_statement_while(ctx);
+		} else if (ctx->parser.symbol == TK_KEY_REPEAT) {
+			parse_statement_repeat(ctx);
+		} else if (ctx->parser.symbol == TK_KEY_FOR) {
+			parse_statement_for(ctx);
+		} else if (ctx->parser.symbol == TK_KEY_CASE) {
+			parse_statement_case(ctx);
 		}
 
-		if (g_symbol == TK_SEMICOLON) {
-			next();
-		} else if ((g_symbol >= TK_SEMICOLON && g_symbol <= TK_KEY_IF)
-		           || g_symbol >= TK_KEY_ARRAY) {
+		if (ctx->parser.symbol == TK_SEMICOLON) {
+			next(ctx);
+		} else if ((ctx->parser.symbol >= TK_SEMICOLON && ctx->parser.symbol <= TK_KEY_IF)
+		           || ctx->parser.symbol >= TK_KEY_ARRAY) {
 			break;
 		} else {
-			scanner_mark_error("; ?");
+			scanner_report_error(ctx, "; ?");
 		}
 	}
 
-	generator_check_registers();
+	leave_recovery(ctx, &recovery);
+	generator_check_registers(ctx);
 }
 
-static Object *parse_identifier_list(ObjectClass klass)
+static Object *parse_identifier_list(CompilerContext *ctx, ObjectClass klass)
 {
-	if (g_symbol == TK_IDENTIFIER) {
-		Object *first = create_object(klass, scanner_get_identifier());
-		next();
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		Object *first = create_object(ctx, klass, scanner_get_atom(ctx));
+		next(ctx);
 
-		while (g_symbol == TK_COMMA) {
-			next();
+		while (ctx->parser.symbol == TK_COMMA) {
+			next(ctx);
 
-			if (g_symbol == TK_IDENTIFIER) {
-				create_object(klass, scanner_get_identifier());
-				next();
+			if (ctx->parser.symbol == TK_IDENTIFIER) {
+				create_object(ctx, klass, scanner_get_atom(ctx));
+				next(ctx);
 			} else {
-				scanner_mark_error("ident?");
+				scanner_mark_error(ctx, "ident?");
 			}
 		}
 
-		sym_assert_then_next(TK_COLON, ":?");
+		sym_assert_then_next(ctx, TK_COLON, ":?");
 		return first;
 	}
 
 	return NULL;
 }
 
-static Type *parse_type_declaration()
+static Type *parse_type_declaration(CompilerContext *ctx)
 {
 	// sync
-	if ((g_symbol != TK_IDENTIFIER) && g_symbol >= TK_KEY_CONST) {
-		scanner_mark_error("type?");
+	if ((ctx->parser.symbol != TK_IDENTIFIER) && ctx->parser.symbol >= TK_KEY_CONST) {
+		scanner_report_error(ctx, "type?");
 
 		do {
-			next();
-		} while ((g_symbol != TK_IDENTIFIER) || (g_symbol < TK_KEY_ARRAY));
+			next(ctx);
+		} while ((ctx->parser.symbol != TK_IDENTIFIER)
+		         && (ctx->parser.symbol < TK_KEY_ARRAY));
 	}
 
 	Type *type = &IntType; // default type
 
-	if (g_symbol == TK_IDENTIFIER) {
-		Object *obj = find_object(scanner_get_identifier());
-		next();
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		Object *obj = find_object(ctx, scanner_get_atom(ctx));
+		next(ctx);
 
 		if (obj->klass == OC_TYPE)
 			type = obj->type;
 		else
-			scanner_mark_error("type?");
-	} else if (g_symbol == TK_KEY_ARRAY) {
-		next();
-		Item item = parse_expression();
+			scanner_mark_error(ctx, "type?");
+	} else if (ctx->parser.symbol == TK_KEY_ARRAY) {
+		next(ctx);
+		Item item = parse_expression(ctx);
 
 		if (item.mode != IM_CONST /*|| item.a < 0*/)
-			scanner_mark_error("bad index");
+			scanner_mark_error(ctx, "bad index");
 
-		sym_assert_then_next(TK_KEY_OF, "of?");
-		Type *base_type = parse_type_declaration();
-		type = malloc(sizeof(*type));
+		sym_assert_then_next(ctx, TK_KEY_OF, "of?");
+		Type *base_type = parse_type_declaration(ctx);
+		type = compiler_alloc(ctx, sizeof(*type));
 		type->form = TF_ARRAY;
 		type->array.base = base_type;
 		type->array.len = item.konst.value;
 		type->size = type->array.len * base_type->size;
-	} else if (g_symbol == TK_KEY_RECORD) {
-		next();
-		type = malloc(sizeof(*type));
+	} else if (ctx->parser.symbol == TK_KEY_RECORD) {
+		next(ctx);
+		type = compiler_alloc(ctx, sizeof(*type));
 		type->form = TF_RECORD;
 		type->size = 0;
-		open_scope();
+		open_scope(ctx);
 
 		while (true) {
-			if (g_symbol == TK_IDENTIFIER) {
+			if (ctx->parser.symbol == TK_IDENTIFIER) {
 				// fields
-				Object *first = parse_identifier_list(OC_FIELD);
-				Type *field_type = parse_type_declaration();
+				Object *first = parse_identifier_list(ctx, OC_FIELD);
+				Type *field_type = parse_type_declaration(ctx);
 
 				// for all field identifiers per type
 				for (Object *it = first; it; it = it->next) {
 					it->type = field_type;
-					it->level = generator_get_current_level();
+					it->level = generator_get_current_level(ctx);
 					it->field.offset = type->size;
 					type->size += it->type->size;
 				}
 			}
 
-			if (g_symbol == TK_SEMICOLON)
-				next();
-			else if (g_symbol == TK_IDENTIFIER)
-				scanner_mark_error(";?");
+			if (ctx->parser.symbol == TK_SEMICOLON)
+				next(ctx);
+			else if (ctx->parser.symbol == TK_IDENTIFIER)
+				scanner_mark_error(ctx, ";?");
 			else
 				break;
 		}
 
-		type->record.fields = g_current_scope->next;
-		close_scope();
-		sym_assert_then_next(TK_KEY_END, "end?");
+		type->record.fields = ctx->parser.current_scope->next;
+		close_scope(ctx);
+		sym_assert_then_next(ctx, TK_KEY_END, "end?");
 	} else {
-		scanner_mark_error("ident?");
+		scanner_mark_error(ctx, "ident?");
 	}
 
 	return type;
 }
 
-static void parse_formal_parameter_section(int *param_block_size)
+static void parse_formal_parameter_section(CompilerContext *ctx, int *param_block_size)
 {
 	int param_size = 0;
 	Object *param_first = NULL;
 	Type *type = NULL;
 
-	if (g_symbol == TK_KEY_VAR) {
-		next();
-		param_first = parse_identifier_list(OC_PARAMETER);
+	if (ctx->parser.symbol == TK_KEY_VAR) {
+		next(ctx);
+		param_first = parse_identifier_list(ctx, OC_PARAMETER);
 	} else {
-		param_first = parse_identifier_list(OC_VAR);
+		param_first = parse_identifier_list(ctx, OC_VAR);
+	}
+
+	if (!param_first)
+		scanner_mark_error(ctx, "ident?");
+
+	bool open_array = false;
+
+	if (ctx->parser.symbol == TK_KEY_ARRAY) {
+		next(ctx);
+		sym_assert_then_next(ctx, TK_KEY_OF, "of?");
+		open_array = true;
 	}
 
-	if (g_symbol == TK_IDENTIFIER) {
-		Object *obj = find_object(scanner_get_identifier());
-		next();
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		Object *obj = find_object(ctx, scanner_get_atom(ctx));
+		next(ctx);
 
 		if (obj->klass == OC_TYPE) {
 			type = obj->type;
 		} else {
-			scanner_mark_error("type?");
+			scanner_mark_error(ctx, "type?");
 			type = &IntType;
 		}
 	} else {
-		scanner_mark_error("ident?");
+		scanner_mark_error(ctx, "ident?");
 		type = &IntType;
 	}
 
-	if (param_first->klass == OC_VAR) {
-		param_size = type->size;
+	if (open_array) {
+		Type *base_type = type;
+		type = compiler_alloc(ctx, sizeof(*type));
+		type->form = TF_ARRAY;
+		type->array.base = base_type;
+		type->array.len = -1;
+		type->size = 0;
+	}
 
-		if (type->form >= TF_ARRAY) {
-			scanner_mark_error("no struct parameter!");
-		}
+	if (param_first->klass == OC_VAR && type->form < TF_ARRAY) {
+		param_size = type->size;
+	} else if (open_array) {
+		// address followed by the length
+		param_size = 2 * generator_get_word_size();
 	} else {
-		// address size (4 bytes)
+		// address size (4 bytes), structured value parameters are passed
+		// by reference too but may not be assigned to
 		param_size = generator_get_word_size();
 	}
 
 	for (Object *it = param_first; it; it = it->next) {
+		if (it->klass == OC_VAR && type->form >= TF_ARRAY) {
+			it->klass = OC_PARAMETER;
+			it->read_only = true;
+		}
+
 		it->type = type;
-		it->level = generator_get_current_level();
+		it->level = generator_get_current_level(ctx);
 		it->var.address_offset = *param_block_size;
 		it->is_param = true;
 		*param_block_size += param_size;
 	}
 }
 
-static void parse_declarations(int *declarations_bytes_needed);
-static void parse_procedure_declaration()
+static void parse_declarations(CompilerContext *ctx, int *declarations_bytes_needed);
+static void parse_procedure_declaration(CompilerContext *ctx)
 {
-	char procedure_name[MAX_STRLEN];
+	Atom procedure_name = 0;
 	const int MarkSize =
 	    4;//TODO@Andreas: Why 4? Maybe generator_get_word_size()? Size of address to jump to
 	Object *proc = NULL;
 	int local_block_size = 0;
 	int param_block_size = 0;
-	next();
+	next(ctx);
 
-	if (g_symbol == TK_IDENTIFIER) {
-		string_copy(procedure_name, scanner_get_identifier());
-		proc = create_object(OC_PROCEDURE, scanner_get_identifier());
-		next();
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		procedure_name = scanner_get_atom(ctx);
+		proc = create_object(ctx, OC_PROCEDURE, scanner_get_atom(ctx));
+		proc->type = NULL; // not a value
+		next(ctx);
 		param_block_size = MarkSize;
-		generator_increase_level(1);
-		open_scope();
+		generator_increase_level(ctx, 1);
+		open_scope(ctx);
 		proc->procedure.entry_point_offset = -1;
 
-		if (g_symbol == TK_LEFT_PAREN) {
-			next();
+		if (ctx->parser.symbol == TK_LEFT_PAREN) {
+			next(ctx);
 
-			if (g_symbol == TK_RIGHT_PAREN) {
-				next();
+			if (ctx->parser.symbol == TK_RIGHT_PAREN) {
+				next(ctx);
 			} else {
-				parse_formal_parameter_section(&param_block_size);
+				parse_formal_parameter_section(ctx, &param_block_size);
 
-				while (g_symbol == TK_SEMICOLON) {
-					next();
-					parse_formal_parameter_section(&param_block_size);
+				while (ctx->parser.symbol == TK_SEMICOLON) {
+					next(ctx);
+					parse_formal_parameter_section(ctx, &param_block_size);
 				}
 
-				sym_assert_then_next(TK_RIGHT_PAREN, ")?");
+				sym_assert_then_next(ctx, TK_RIGHT_PAREN, ")?");
 			}
 		}
 
 		local_block_size = param_block_size;
-		proc->parent = g_current_scope->next;
-		sym_assert_then_next(TK_SEMICOLON, ";?");
-		parse_declarations(&local_block_size);
+		proc->parent = ctx->parser.current_scope->next;
+		// everything declared from here on is released with the scope, the
+		// parameters stay for checking the calls
+		Object *params_end = ctx->parser.current_scope->head.last;
+
+		if (params_end == NULL)
+			params_end = ctx->parser.current_scope;
 
-		while (g_symbol == TK_KEY_PROCEDURE) {
-			parse_procedure_declaration();
-			sym_assert_then_next(TK_SEMICOLON, ";?");
+		ArenaMark locals = compiler_mark(ctx);
+		sym_assert_then_next(ctx, TK_SEMICOLON, ";?");
+		parse_declarations(ctx, &local_block_size);
+
+		while (ctx->parser.symbol == TK_KEY_PROCEDURE) {
+			parse_procedure_declaration(ctx);
+			sym_assert_then_next(ctx, TK_SEMICOLON, ";?");
 		}
 
-		proc->procedure.entry_point_offset = generator_get_program_counter();
-		generator_enter(param_block_size, local_block_size);
+		proc->procedure.entry_point_offset = generator_get_program_counter(ctx);
+		generator_enter(ctx, param_block_size, local_block_size);
 
-		if (g_symbol == TK_KEY_BEGIN) {
-			next();
-			parse_statement_sequence();
+		if (ctx->parser.symbol == TK_KEY_BEGIN) {
+			next(ctx);
+			parse_statement_sequence(ctx);
 		}
 
-		sym_assert_then_next(TK_KEY_END, "end?");
+		sym_assert_then_next(ctx, TK_KEY_END, "end?");
 
-		if (g_symbol == TK_IDENTIFIER) {
-			if (!string_equal(procedure_name, scanner_get_identifier()))
-				scanner_mark_error("no match");
+		if (ctx->parser.symbol == TK_IDENTIFIER) {
+			if (procedure_name != scanner_get_atom(ctx))
+				scanner_mark_error(ctx, "no match");
 
-			next();
+			next(ctx);
 		}
 
-		generator_return(local_block_size);
-		close_scope();
-		generator_increase_level(-1);
+		generator_return(ctx, local_block_size);
+		close_scope(ctx);
+		params_end->next = NULL;
+		compiler_release(ctx, locals);
+		generator_increase_level(ctx, -1);
 	}
 }
 
-static void parse_declarations(int *declarations_bytes_needed)
+static void parse_declarations(CompilerContext *ctx, int *declarations_bytes_needed)
 {
-	int variables_size = *declarations_bytes_needed;
+	// kept across a recovery
+	volatile int variables_size = *declarations_bytes_needed;
+	volatile TokenKind section = TK_UNKNOWN; // the declarations being parsed
+	Recovery recovery;
+	enter_recovery(ctx, &recovery);
+
+	if (setjmp(recovery.buf) != 0) {
+		// skip the rest of the declaration
+		recover(ctx, &recovery);
+
+		while (ctx->parser.symbol != TK_SEMICOLON && ctx->parser.symbol != TK_KEY_END
+		       && ctx->parser.symbol < TK_KEY_CONST)
+			next(ctx);
+
+		if (ctx->parser.symbol == TK_SEMICOLON)
+			next(ctx);
+	}
 
 	// sync
-	if (g_symbol < TK_KEY_CONST && g_symbol != TK_KEY_END) {
-		scanner_mark_error("declaration?");
+	if (ctx->parser.symbol < TK_KEY_CONST && ctx->parser.symbol != TK_KEY_END
+	    && section == TK_UNKNOWN) {
+		scanner_report_error(ctx, "declaration?");
 
 		do {
-			next();
-		} while ((g_symbol < TK_KEY_CONST) && (g_symbol != TK_KEY_END));
+			next(ctx);
+		} while ((ctx->parser.symbol < TK_KEY_CONST)
+		         && (ctx->parser.symbol != TK_KEY_END));
 	}
 
 	while (true) {
-		if (g_symbol == TK_KEY_CONST) {
-			next();
-
-			while (g_symbol == TK_IDENTIFIER) {
-				Object *obj = create_object(OC_CONST, scanner_get_identifier());
-				next();
-				sym_assert_then_next(TK_EQUAL, "=?");
-				Item item = parse_expression();
-
-				if (item.mode == IM_CONST) {
-					obj->konst.value = item.konst.value;
-					obj->type = item.type;
-				} else {
-					scanner_mark_error("expression not constant");
-				}
-
-				sym_assert_then_next(TK_SEMICOLON, ";?");
+		if (ctx->parser.symbol >= TK_KEY_CONST && ctx->parser.symbol <= TK_KEY_VAR) {
+			// the sections come in the order const, type, var
+			if (ctx->parser.symbol <= section)
+				scanner_report_error(ctx, "declaration?");
+
+			section = ctx->parser.symbol;
+			next(ctx);
+		} else if (ctx->parser.symbol != TK_IDENTIFIER || section == TK_UNKNOWN) {
+			break;
+		} else if (section == TK_KEY_CONST) {
+			Atom name = scanner_get_atom(ctx);
+			Object *obj = create_object(ctx, OC_CONST, name);
+			next(ctx);
+			sym_assert_then_next(ctx, TK_EQUAL, "=?");
+			Item item = parse_expression(ctx);
+
+			if (item.mode == IM_CONST) {
+				obj->konst.value = item.konst.value;
+				obj->type = item.type;
+			} else {
+				scanner_mark_error(ctx, "expression not constant");
 			}
-		}
 
-		if (g_symbol == TK_KEY_TYPE) {
-			next();
-
-			while (g_symbol == TK_IDENTIFIER) {
-				Object *obj = create_object(OC_TYPE, scanner_get_identifier());
-				next();
-				sym_assert_then_next(TK_EQUAL, "=?");
-				obj->type = parse_type_declaration();
-				sym_assert_then_next(TK_SEMICOLON, ";?");
+			sym_assert_then_next(ctx, TK_SEMICOLON, ";?");
+		} else if (section == TK_KEY_TYPE) {
+			Atom name = scanner_get_atom(ctx);
+			Object *obj = create_object(ctx, OC_TYPE, name);
+			next(ctx);
+			sym_assert_then_next(ctx, TK_EQUAL, "=?");
+			obj->type = parse_type_declaration(ctx);
+			sym_assert_then_next(ctx, TK_SEMICOLON, ";?");
+		} else {
+			Object *first = parse_identifier_list(ctx, OC_VAR);
+			Type *type = parse_type_declaration(ctx);
+
+			for (Object *it = first; it; it = it->next) {
+				it->type = type;
+				it->level = generator_get_current_level(ctx);
+				// here we use the size as an address/offset...
+				it->var.address_offset = variables_size;
+				variables_size += it->type->size;
+				it->is_param = false;
 			}
-		}
-
-		if (g_symbol == TK_KEY_VAR) {
-			next();
-
-			while (g_symbol == TK_IDENTIFIER) {
-				Object *first = parse_identifier_list(OC_VAR);
-				Type *type = parse_type_declaration();
-
-				for (Object *it = first; it; it = it->next) {
-					it->type = type;
-					it->level = generator_get_current_level();
-					// here we use the size as an address/offset...
-					it->var.address_offset = variables_size;
-					variables_size += it->type->size;
-					it->is_param = false;
-				}
 
-				sym_assert_then_next(TK_SEMICOLON, ";?");
-			}
+			sym_assert_then_next(ctx, TK_SEMICOLON, ";?");
 		}
-
-		if (g_symbol >= TK_KEY_CONST && g_symbol <= TK_KEY_VAR)
-			scanner_mark_error("declaration?");
-		else
-			break;
 	}
 
+	leave_recovery(ctx, &recovery);
 	*declarations_bytes_needed = variables_size;
 }
 
-static void parse_module()
+static void parse_module(CompilerContext *ctx)
 {
-	Object *obj = NULL;
-	char module_name[MAX_STRLEN] = {0};
+	Atom module_name = 0;
 	int declarations_bytes_needed = 0;
 
-	if (g_symbol != TK_KEY_MODULE) {
-		scanner_mark_error("module?");
+	if (ctx->parser.symbol != TK_KEY_MODULE) {
+		scanner_mark_error(ctx, "module?");
 		return;
 	}
 
-	// insert here all module/global scope names
-	open_scope(); // module scope
-	g_module_scope = g_current_scope;
+	open_scope(ctx); // module scope, enclosed by the universe
+	ctx->parser.module_scope = ctx->parser.current_scope;
+
+	next(ctx);
+
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		module_name = scanner_get_atom(ctx);
+		next(ctx);
+	}
+
+	sym_assert_then_next(ctx, TK_SEMICOLON, ";?");
+	// global declaration
+	parse_declarations(ctx, &declarations_bytes_needed);
+
+	while (ctx->parser.symbol == TK_KEY_PROCEDURE) {
+		parse_procedure_declaration(ctx);
+		sym_assert_then_next(ctx, TK_SEMICOLON, ";?");
+	}
+
+	// allocate space for global declarations
+	// module header?
+	generator_header(ctx, declarations_bytes_needed);
+
+	if (ctx->parser.symbol == TK_KEY_BEGIN) {
+		next(ctx);
+		parse_statement_sequence(ctx);
+	}
+
+	sym_assert_then_next(ctx, TK_KEY_END, "end?");
+
+	if (ctx->parser.symbol == TK_IDENTIFIER) {
+		if (module_name != scanner_get_atom(ctx))
+			scanner_mark_error(ctx, "no match");
+
+		next(ctx);
+	} else {
+		scanner_mark_error(ctx, "ident?");
+	}
+
+	sym_assert_then_next(ctx, TK_PERIOD, ".?");
+	close_scope(ctx);
+
+	if (!scanner_has_error(ctx)) {
+		generator_close();
+	}
+}
+
+// The predeclared identifiers are entered once per context. Their scope
+// encloses the module scope of every compilation.
+static void open_universe(CompilerContext *ctx)
+{
+	Object *obj = NULL;
+	ctx->parser.current_scope = NULL;
+	open_scope(ctx);
 
-	///////////////////////////////////////////////////
-	create_object(OC_TYPE, "integer")->type = &IntType;
-	create_object(OC_TYPE, "bool")->type = &BoolType;
-	obj = create_object(OC_CONST, "true");
+	create_object(ctx, OC_TYPE, scanner_intern(ctx, "integer"))->type = &IntType;
+	create_object(ctx, OC_TYPE, scanner_intern(ctx, "bool"))->type = &BoolType;
+	obj = create_object(ctx, OC_CONST, scanner_intern(ctx, "true"));
 	obj->type = &BoolType;
 	obj->konst.value = 1;
-	obj = create_object(OC_CONST, "false");
+	obj = create_object(ctx, OC_CONST, scanner_intern(ctx, "false"));
 	obj->type = &BoolType;
 	obj->konst.value = 0;
 
-	obj = create_object(OC_BUILTIN_PROCEDURE, "get");
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "get"));
 	obj->type = NULL;
 	obj->builtin_procedure.function_number = 0;
 
-	obj = create_object(OC_BUILTIN_PROCEDURE, "put");
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "put"));
 	obj->type = NULL;
 	obj->builtin_procedure.function_number = 1;
 
-	obj = create_object(OC_BUILTIN_PROCEDURE, "ord");
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "ord"));
 	obj->type = &IntType;
 	obj->builtin_procedure.function_number = 2;
 
-	obj = create_object(OC_BUILTIN_PROCEDURE, "odd");
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "odd"));
 	obj->type = &IntType;
 	obj->builtin_procedure.function_number = 3;
 
-	obj = create_object(OC_BUILTIN_PROCEDURE, "bit");
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "bit"));
 	obj->type = &IntType;
 	obj->builtin_procedure.function_number = 4;
-	///////////////////////////////////////////////////
-
-	next();
-
-	if (g_symbol == TK_IDENTIFIER) {
-		string_copy(module_name, scanner_get_identifier());
-		next();
-	}
-
-	sym_assert_then_next(TK_SEMICOLON, ";?");
-	// global declaration
-	parse_declarations(&declarations_bytes_needed);
-
-	while (g_symbol == TK_KEY_PROCEDURE) {
-		parse_procedure_declaration();
-		sym_assert_then_next(TK_SEMICOLON, ";?");
-	}
 
-	// allocate space for global declarations
-	// module header?
-	generator_header(declarations_bytes_needed);
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "len"));
+	obj->type = &IntType;
+	obj->builtin_procedure.function_number = 5;
 
-	if (g_symbol == TK_KEY_BEGIN) {
-		next();
-		parse_statement_sequence();
-	}
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "read"));
+	obj->type = NULL;
+	obj->builtin_procedure.function_number = 6;
 
-	sym_assert_then_next(TK_KEY_END, "end?");
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "write"));
+	obj->type = NULL;
+	obj->builtin_procedure.function_number = 7;
 
-	if (g_symbol == TK_IDENTIFIER) {
-		if (!string_equal(module_name, scanner_get_identifier()))
-			scanner_mark_error("no match");
+	obj = create_object(ctx, OC_BUILTIN_PROCEDURE, scanner_intern(ctx, "writeln"));
+	obj->type = NULL;
+	obj->builtin_procedure.function_number = 8;
+	ctx->parser.universe = ctx->parser.current_scope;
+	ctx->parser.current_scope = NULL;
+}
 
-		next();
-	} else {
-		scanner_mark_error("ident?");
-	}
+void parse_init(CompilerContext *ctx)
+{
+	ctx->parser.unroll_factor = DefaultUnrollFactor;
+	open_universe(ctx);
+}
 
-	sym_assert_then_next(TK_PERIOD, ".?");
-	close_scope();
+void parse_release(CompilerContext *ctx)
+{
+	symbols_release(&ctx->parser.symbols);
+	free(ctx->parser.if_chains);
+}
 
-	if (!scanner_has_error()) {
-		generator_close();
-	}
+void parse_set_unroll_factor(CompilerContext *ctx, int factor)
+{
+	ctx->parser.unroll_factor = factor;
 }
 
-void parse_program(const char *source)
+void parse_program(CompilerContext *ctx, const char *source)
 {
-	scanner_init(source);
-	next();
-	parse_module();
+	ctx->parser.module_scope = NULL;
+	ctx->parser.current_scope = ctx->parser.universe;
+	// an earlier compilation may have stopped with scopes still open
+	symbols_reset(&ctx->parser.symbols);
+	ctx->parser.symbols.depth = 1;
+	ctx->parser.token = -1;
+	ctx->parser.generation = ++ctx->parser.last_generation;
+
+	for (Object *it = ctx->parser.universe->next; it; it = it->next)
+		symbols_bind(&ctx->parser.symbols, it);
+
+	scanner_init(ctx, source);
+	next(ctx);
+	parse_module(ctx);
 }
@@ -1,6 +1,34 @@
 #ifndef PARSER_H
 #define PARSER_H
+#include "scanner.h"
+#include "objects.h"
+#ifndef __cplusplus
+typedef struct Parser Parser;
+typedef struct CompilerContext CompilerContext;
+#endif
+
+struct Parser {
+	TokenKind   symbol;
+	Object     *module_scope;
+	Object     *current_scope;
+	Object     *universe;      // predeclared identifiers, kept between compilations
+	SymbolTable symbols;       // the declarations visible in current_scope
+	int         unroll_factor;
+	int         calls;         // procedure calls compiled, counted for loop unrolling
+	int         token;         // index of the current token in the source
+	// Decisions whether an 'if' is an equality chain, by the index of its
+	// token: the generation they were made in, shifted left, and 1 for a
+	// chain. A generation ends with the compilation or when the meaning of
+	// a name changes, as for the control variable of an unrolled loop.
+	unsigned   *if_chains;
+	int         if_chains_capacity;
+	unsigned    generation;
+	unsigned    last_generation;
+};
 
-void parse_program(const char *source);
+void parse_init(CompilerContext *ctx); // default options and the universe
+void parse_release(CompilerContext *ctx);
+void parse_program(CompilerContext *ctx, const char *source);
+void parse_set_unroll_factor(CompilerContext *ctx, int factor); // 1 disables loop unrolling
 
 #endif
@@ -0,0 +1,101 @@
+#include "ring.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+
+// Items are published and taken back this many at a time, so the two
+// sides don't trade the cache lines of head and tail for every item
+enum { Batch = 64 };
+
+#define LOAD(field)         __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+void ring_init(Ring *ring, size_t item_size, int capacity)
+{
+	assert(capacity >= Batch && (capacity & (capacity - 1)) == 0);
+	ring->items = malloc(capacity * item_size);
+
+	if (!ring->items)
+		abort(); // out of memory
+
+	ring->item_size = item_size;
+	ring->mask = (uint32_t)capacity - 1;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->closed = false;
+	ring->cancelled = false;
+	ring->push_at = 0;
+	ring->free_until = (uint32_t)capacity;
+	ring->pop_at = 0;
+	ring->ready_until = 0;
+}
+
+void ring_free(Ring *ring)
+{
+	free(ring->items);
+	ring->items = NULL;
+}
+
+void *ring_reserve(Ring *ring)
+{
+	while (ring->push_at == ring->free_until) {
+		if (LOAD(ring->cancelled))
+			return NULL;
+
+		// the consumer may be waiting for the items of this batch
+		STORE(ring->tail, ring->push_at);
+		ring->free_until = LOAD(ring->head) + ring->mask + 1;
+
+		if (ring->push_at == ring->free_until)
+			sched_yield();
+	}
+
+	return ring->items + (ring->push_at & ring->mask) * ring->item_size;
+}
+
+void ring_push(Ring *ring)
+{
+	ring->push_at += 1;
+
+	if (ring->push_at % Batch == 0)
+		STORE(ring->tail, ring->push_at);
+}
+
+void ring_close(Ring *ring)
+{
+	STORE(ring->tail, ring->push_at);
+	STORE(ring->closed, true);
+}
+
+void *ring_peek(Ring *ring)
+{
+	while (ring->pop_at == ring->ready_until) {
+		// the producer may be waiting for room
+		STORE(ring->head, ring->pop_at);
+		bool closed = LOAD(ring->closed);
+		ring->ready_until = LOAD(ring->tail);
+
+		if (ring->pop_at != ring->ready_until)
+			break;
+
+		if (closed)
+			return NULL;
+
+		sched_yield();
+	}
+
+	return ring->items + (ring->pop_at & ring->mask) * ring->item_size;
+}
+
+void ring_pop(Ring *ring)
+{
+	ring->pop_at += 1;
+
+	if (ring->pop_at % Batch == 0)
+		STORE(ring->head, ring->pop_at);
+}
+
+void ring_cancel(Ring *ring)
+{
+	STORE(ring->cancelled, true);
+}
@@ -0,0 +1,39 @@
+#ifndef RING_H
+#define RING_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free queue of fixed-size items from one producer thread to one
+// consumer thread. Pushed items are published in batches, ring_close
+// publishes the rest. A side that finds the ring full or empty yields
+// until the other side catches up.
+typedef struct {
+	unsigned char *items;
+	size_t         item_size;
+	uint32_t       mask;      // capacity - 1, the capacity is a power of 2
+	// shared, each side writes its own and reads the other's
+	uint32_t       head __attribute__((aligned(64))); // next to pop
+	uint32_t       tail __attribute__((aligned(64))); // behind the last published
+	bool           closed;    // by the producer, nothing follows
+	bool           cancelled; // by the consumer, nothing is taken anymore
+	// producer only
+	uint32_t       push_at __attribute__((aligned(64)));
+	uint32_t       free_until; // push_at may go up to here without waiting
+	// consumer only
+	uint32_t       pop_at __attribute__((aligned(64)));
+	uint32_t       ready_until; // items up to here are published
+} Ring;
+
+void  ring_init(Ring *ring, size_t item_size, int capacity); // a power of 2
+void  ring_free(Ring *ring);
+// Producer: the next item to fill in, NULL once the consumer cancelled
+void *ring_reserve(Ring *ring);
+void  ring_push(Ring *ring); // the reserved item
+void  ring_close(Ring *ring);
+// Consumer: the next item, NULL at the end of a closed ring
+void *ring_peek(Ring *ring);
+void  ring_pop(Ring *ring);  // the peeked item
+void  ring_cancel(Ring *ring);
+
+#endif // RING_H
@@ -0,0 +1,226 @@
+#include "compiler.h"
+#include "utils.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Runtime benchmark on the example programs of the book. Every program is
+ * compiled once and run on each execution target with a fixed input, the
+ * output is checked against the expected one. The dynamic instruction count
+ * measures the generated code, the instructions per second measure the
+ * target.
+ */
+
+typedef struct {
+	const char *name;
+	const char *file;     // in the program directory
+	const char *input;
+	const char *expected; // output
+} Program;
+
+static const Program Programs[] = {
+	{"sample",    "01sample.ob0",      "37 41 100 7 8 2 3 5 7 11 13 17 19 10",
+	 " 0 2624 1517\n 100 7 14 2\n 4 4 11\n"},
+	{"multiply",  "run_multiply.ob0",  "20000 37 41",        " 821476 905313\n"},
+	{"divide",    "run_divide.ob0",    "10000 1000000 7",    " 144285 4 734979\n"},
+	{"binsearch", "run_binsearch.ob0", "1000 3",             " 1000 1500500\n"},
+};
+
+// An execution target runs the code of a compilation. Each one reports an
+// error message of a failed load or run, else NULL.
+typedef struct {
+	const char *name;
+	void     *(*create)(void);
+	void      (*destroy)(void *target);
+	bool      (*load)(void *target, const CompilerContext *ctx);
+	bool      (*run)(void *target, const char *input);
+	const char *(*get_output)(void *target);
+	const char *(*get_error)(void *target);
+	long long (*get_instruction_count)(void *target);
+} Target;
+
+enum { MemorySize = 1 << 20 };
+
+static void *vm_target_create(void)
+{
+	VirtualMachine *vm = vm_create(MemorySize);
+	vm_set_instruction_limit(vm, 1000000000);
+	return vm;
+}
+
+static void vm_target_destroy(void *vm)
+{
+	vm_destroy(vm);
+}
+
+static bool vm_target_load(void *vm, const CompilerContext *ctx)
+{
+	return vm_load(vm, ctx);
+}
+
+static bool vm_target_run(void *vm, const char *input)
+{
+	return vm_run(vm, input);
+}
+
+static const char *vm_target_get_output(void *vm)
+{
+	return vm_get_output(vm);
+}
+
+static const char *vm_target_get_error(void *vm)
+{
+	return vm_get_error(vm);
+}
+
+static long long vm_target_get_instruction_count(void *vm)
+{
+	return vm_get_instruction_count(vm);
+}
+
+static const Target Targets[] = {
+	{"vm", vm_target_create, vm_target_destroy, vm_target_load, vm_target_run,
+	 vm_target_get_output, vm_target_get_error, vm_target_get_instruction_count},
+};
+
+typedef struct {
+	int         runs; // of each program on each target
+	const char *directory;
+} Options;
+
+static double now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static bool compile_program(CompilerContext *ctx, const Program *program, const Options *options)
+{
+	char path[MAX_STRLEN];
+	FileText source;
+	snprintf(path, sizeof(path), "%s/%s", options->directory, program->file);
+
+	if (!file_open_text(&source, path)) {
+		printf("Error: Could not open file %s.\n", path);
+		return false;
+	}
+
+	bool ok = compiler_compile(ctx, source.data);
+	file_close_text(&source);
+
+	if (!ok)
+		printf("Error: %s: line %d: %s\n", path, compiler_get_error_line(ctx),
+		       compiler_get_error(ctx));
+
+	return ok;
+}
+
+static bool run_program(const CompilerContext *ctx, const Program *program, const Target *target,
+                        const Options *options)
+{
+	void *machine = target->create();
+	double *seconds = malloc(options->runs * sizeof(*seconds));
+	bool ok = target->load(machine, ctx);
+	const char *error = ok ? NULL : target->get_error(machine);
+
+	for (int run = 0; run < options->runs && ok; run++) {
+		double start = now();
+		ok = target->run(machine, program->input);
+		seconds[run] = now() - start;
+
+		if (!ok) {
+			error = target->get_error(machine);
+		} else if (!string_equal(target->get_output(machine), program->expected)) {
+			error = "wrong output";
+			ok = false;
+		}
+	}
+
+	if (!ok) {
+		printf("Error: %s on %s: %s\n", program->name, target->name, error);
+	} else {
+		qsort(seconds, options->runs, sizeof(*seconds), compare_doubles);
+		double median = seconds[(options->runs - 1) / 2];
+		long long instructions = target->get_instruction_count(machine);
+		printf("%-10s %-6s %6d %12lld %9.3f %9.3f %9.1f\n", program->name, target->name,
+		       compiler_get_code_size(ctx), instructions, median * 1e3, seconds[0] * 1e3,
+		       median > 0 ? instructions / median * 1e-6 : 0);
+	}
+
+	target->destroy(machine);
+	free(seconds);
+	return ok;
+}
+
+static int parse_count(const char *text, const char *what)
+{
+	int count = atoi(text);
+
+	if (count < 1) {
+		printf("Error: Bad %s %s.\n", what, text);
+		exit(EXIT_FAILURE);
+	}
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	Options options = {10, "tests"};
+	bool selected[ARRAY_COUNT(Programs)] = {false};
+	bool any_selected = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--runs=", 7) == 0) {
+			options.runs = parse_count(argv[i] + 7, "run count");
+		} else if (strncmp(argv[i], "--dir=", 6) == 0) {
+			options.directory = argv[i] + 6;
+		} else {
+			size_t k = 0;
+
+			while (k < ARRAY_COUNT(Programs) && !string_equal(argv[i], Programs[k].name))
+				k++;
+
+			if (k == ARRAY_COUNT(Programs)) {
+				printf("Error: Unknown program %s.\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+
+			selected[k] = true;
+			any_selected = true;
+		}
+	}
+
+	CompilerContext *ctx = compiler_create();
+	bool ok = true;
+
+	printf("%-10s %-6s %6s %12s %9s %9s %9s\n", "program", "target", "code", "instructions",
+	       "p50 ms", "min ms", "Minstr/s");
+
+	for (size_t k = 0; k < ARRAY_COUNT(Programs); k++) {
+		if (any_selected && !selected[k])
+			continue;
+
+		if (!compile_program(ctx, &Programs[k], &options)) {
+			ok = false;
+			continue;
+		}
+
+		for (size_t t = 0; t < ARRAY_COUNT(Targets); t++)
+			ok = run_program(ctx, &Programs[k], &Targets[t], &options) && ok;
+	}
+
+	compiler_destroy(ctx);
+	return ok ? 0 : EXIT_FAILURE;
+}
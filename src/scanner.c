@@ -1,283 +1,502 @@
 #include "scanner.h"
+#include "context.h"
 #include "utils.h"
+#include "ring.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <stdarg.h>
-
-static int         g_line = 1;
-static const char *g_current = 0;
-static bool        g_error = false;
-
-static char        g_ch = '\0';
-static char        g_identifier[MAX_STRLEN] = {0};
-static int         g_number = 0;
+#include <setjmp.h>
+#include <pthread.h>
 
 struct KeywordEntry {
-	TokenKind kind;
+	TokenKind   kind;
 	const char *identifier;
+	int         length;
 };
 
-static struct KeywordEntry
-g_keyword_table[] = {
-	{ TK_DIV,          "div"       },
-	{ TK_MOD,          "mod"       },
-	{ TK_LOGIC_OR,     "or"        },
-	{ TK_KEY_OF,       "of"        },
-	{ TK_KEY_THEN,     "then"      },
-	{ TK_KEY_DO,       "do"        },
-	{ TK_KEY_END,      "end"       },
-	{ TK_KEY_ELSE,     "else"      },
-	{ TK_KEY_ELSEIF,   "elsif"     },
-	{ TK_KEY_UNTIL,    "until"     },
-	{ TK_KEY_IF,       "if"        },
-	{ TK_KEY_WHILE,    "while"     },
-	{ TK_KEY_REPEAT,   "repeat"    },
-	{ TK_KEY_ARRAY,    "array"     },
-	{ TK_KEY_RECORD,   "record"    },
-	{ TK_KEY_CONST,    "const"     },
-	{ TK_KEY_TYPE,     "type"      },
-	{ TK_KEY_VAR,      "var"       },
-	{ TK_KEY_PROCEDURE, "procedure" },
-	{ TK_KEY_BEGIN,    "begin"     },
-	{ TK_KEY_MODULE,   "module"    },
+// Perfect hash of the keywords over their length and their first and last
+// characters. A collision would initialize a slot of the table twice,
+// which the compiler reports (-Woverride-init).
+#define KEYWORD_HASH(first, last, length) ((((first) + (last)) * 5 + (length)) & 63)
+#define KEYWORD(name, first, last, kind) \
+	[KEYWORD_HASH(first, last, sizeof(name) - 1)] = { kind, name, sizeof(name) - 1 }
+
+static const struct KeywordEntry
+g_keyword_table[64] = {
+	KEYWORD("div",       'd', 'v', TK_DIV),
+	KEYWORD("mod",       'm', 'd', TK_MOD),
+	KEYWORD("or",        'o', 'r', TK_LOGIC_OR),
+	KEYWORD("of",        'o', 'f', TK_KEY_OF),
+	KEYWORD("then",      't', 'n', TK_KEY_THEN),
+	KEYWORD("do",        'd', 'o', TK_KEY_DO),
+	KEYWORD("to",        't', 'o', TK_KEY_TO),
+	KEYWORD("by",        'b', 'y', TK_KEY_BY),
+	KEYWORD("end",       'e', 'd', TK_KEY_END),
+	KEYWORD("else",      'e', 'e', TK_KEY_ELSE),
+	KEYWORD("elsif",     'e', 'f', TK_KEY_ELSEIF),
+	KEYWORD("until",     'u', 'l', TK_KEY_UNTIL),
+	KEYWORD("if",        'i', 'f', TK_KEY_IF),
+	KEYWORD("case",      'c', 'e', TK_KEY_CASE),
+	KEYWORD("while",     'w', 'e', TK_KEY_WHILE),
+	KEYWORD("repeat",    'r', 't', TK_KEY_REPEAT),
+	KEYWORD("for",       'f', 'r', TK_KEY_FOR),
+	KEYWORD("array",     'a', 'y', TK_KEY_ARRAY),
+	KEYWORD("record",    'r', 'd', TK_KEY_RECORD),
+	KEYWORD("const",     'c', 't', TK_KEY_CONST),
+	KEYWORD("type",      't', 'e', TK_KEY_TYPE),
+	KEYWORD("var",       'v', 'r', TK_KEY_VAR),
+	KEYWORD("procedure", 'p', 'e', TK_KEY_PROCEDURE),
+	KEYWORD("begin",     'b', 'n', TK_KEY_BEGIN),
+	KEYWORD("module",    'm', 'e', TK_KEY_MODULE),
 };
 
-inline static char get_char(void)
+// Lines are counted when they are needed, see line_at
+inline static char get_char(Scanner *s)
 {
-	char c = *g_current;
-
-	if (c == '\0')
-		return c;
+	char c = *s->current;
 
-	if (c == '\n')
-		g_line += 1;
+	if (c != '\0')
+		s->current += 1;
 
-	g_current += 1;
 	return c;
 }
 
-inline static void unget_char(void)
+inline static void unget_char(Scanner *s)
 {
-	g_current -= 1;
-	g_ch = *g_current;
+	s->current -= 1;
+	s->ch = *s->current;
 }
 
-static TokenKind scan_identifier(void)
+/*
+ * The runs of whitespace, identifier characters and comments are skipped
+ * a block of 16 (SSE2) or 32 (AVX2) bytes at a time. The blocks are
+ * aligned, so a block holding the terminating '\0' never reaches into
+ * the next page. The bytes of a block before the start are masked off.
+ */
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#include <stdint.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef NO_ASAN
+#define NO_ASAN
+#endif
+
+#if defined(__AVX2__)
+typedef __m256i Block;
+enum { BlockSize = 32 };
+static const uint32_t BlockBits = 0xffffffffu;
+#define block_load(p)       _mm256_load_si256((const Block *)(p))
+#define block_loadu(p)      _mm256_loadu_si256((const Block *)(p))
+#define block_set(c)        _mm256_set1_epi8(c)
+#define block_eq(a, b)      _mm256_cmpeq_epi8(a, b)
+#define block_gt(a, b)      _mm256_cmpgt_epi8(a, b)
+#define block_and(a, b)     _mm256_and_si256(a, b)
+#define block_or(a, b)      _mm256_or_si256(a, b)
+#define block_mask(a)       ((uint32_t)_mm256_movemask_epi8(a))
+#else
+typedef __m128i Block;
+enum { BlockSize = 16 };
+static const uint32_t BlockBits = 0xffffu;
+#define block_load(p)       _mm_load_si128((const Block *)(p))
+#define block_loadu(p)      _mm_loadu_si128((const Block *)(p))
+#define block_set(c)        _mm_set1_epi8(c)
+#define block_eq(a, b)      _mm_cmpeq_epi8(a, b)
+#define block_gt(a, b)      _mm_cmpgt_epi8(a, b)
+#define block_and(a, b)     _mm_and_si128(a, b)
+#define block_or(a, b)      _mm_or_si128(a, b)
+#define block_mask(a)       ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+// Bytes from 'low' to 'high', both ASCII
+static inline Block block_range(Block b, char low, char high)
 {
-	assert(is_ident(g_ch));
-	// identifier
-	int i = 0;
+	return block_and(block_gt(b, block_set(low - 1)), block_gt(block_set(high + 1), b));
+}
 
-	do {
-		if (i < MAX_STRLEN) {
-			g_identifier[i] = g_ch;
-			i += 1;
-		}
+// Masks of the bytes ending a run
+static inline uint32_t not_ident_mask(Block b)
+{
+	Block ident = block_or(block_or(block_range(b, 'a', 'z'), block_range(b, 'A', 'Z')),
+	                       block_or(block_range(b, '0', '9'), block_eq(b, block_set('_'))));
+	return ~block_mask(ident) & BlockBits;
+}
 
-		g_ch = get_char();
-	} while (is_ident(g_ch));
+static inline uint32_t not_space_mask(Block b)
+{
+	Block space = block_or(block_or(block_eq(b, block_set(' ')), block_eq(b, block_set('\n'))),
+	                       block_or(block_eq(b, block_set('\t')), block_eq(b, block_set('\r'))));
+	return ~block_mask(space) & BlockBits;
+}
 
-	g_identifier[i] = '\0';
+static inline uint32_t line_end_mask(Block b)
+{
+	return block_mask(block_or(block_eq(b, block_set('\n')), block_eq(b, block_set('\0'))));
+}
 
-	// keyword
-	int k = 0;
+static inline uint32_t comment_mark_mask(Block b)
+{
+	Block marks = block_or(block_eq(b, block_set('(')), block_eq(b, block_set('*')));
+	return block_mask(block_or(marks, block_eq(b, block_set('\0'))));
+}
 
-	while (k < ARRAY_COUNT(g_keyword_table)
-	       && !string_equal(g_keyword_table[k].identifier, g_identifier)) {
-		k += 1;
+// First byte from p on with its bit in the mask, the terminating '\0'
+// has to be in the mask
+NO_ASAN static inline const char *find_first(const char *p, uint32_t (*mask_of)(Block))
+{
+	const char *block = (const char *)((uintptr_t)p & ~(uintptr_t)(BlockSize - 1));
+	uint32_t found = mask_of(block_load(block)) & (BlockBits << (p - block));
+
+	while (found == 0) {
+		block += BlockSize;
+		found = mask_of(block_load(block));
 	}
 
-	if (k < ARRAY_COUNT(g_keyword_table)) {
-		return g_keyword_table[k].kind;
+	return block + __builtin_ctz(found);
+}
+
+static const char *skip_ident_chars(const char *p)
+{
+	return find_first(p, not_ident_mask);
+}
+
+static const char *skip_space_chars(const char *p)
+{
+	return find_first(p, not_space_mask);
+}
+
+static const char *find_line_end(const char *p)
+{
+	return find_first(p, line_end_mask);
+}
+
+static const char *find_comment_mark(const char *p)
+{
+	return find_first(p, comment_mark_mask);
+}
+
+static int count_lines(const char *begin, const char *end)
+{
+	int lines = 0;
+	Block newline = block_set('\n');
+
+	for (; end - begin >= BlockSize; begin += BlockSize)
+		lines += __builtin_popcount(block_mask(block_eq(block_loadu(begin), newline)));
+
+	for (; begin < end; begin++)
+		lines += *begin == '\n';
+
+	return lines;
+}
+#else
+static const char *skip_ident_chars(const char *p)
+{
+	while (is_ident(*p))
+		p += 1;
+
+	return p;
+}
+
+static const char *skip_space_chars(const char *p)
+{
+	while (has_char_class(*p, CHAR_SPACE))
+		p += 1;
+
+	return p;
+}
+
+static const char *find_line_end(const char *p)
+{
+	while (*p != '\n' && *p != '\0')
+		p += 1;
+
+	return p;
+}
+
+static const char *find_comment_mark(const char *p)
+{
+	while (*p != '(' && *p != '*' && *p != '\0')
+		p += 1;
+
+	return p;
+}
+
+static int count_lines(const char *begin, const char *end)
+{
+	int lines = 0;
+
+	for (; begin < end; begin++)
+		lines += *begin == '\n';
+
+	return lines;
+}
+#endif
+
+// Counts the lines up to 'at', on from the last count unless it is behind
+static int line_at(Scanner *s, const char *at)
+{
+	if (at < s->line_counted) {
+		s->line = 1;
+		s->line_counted = s->source;
 	}
 
+	s->line += count_lines(s->line_counted, at);
+	s->line_counted = at;
+	return s->line;
+}
+
+static void raise_error(CompilerContext *ctx, bool lexical) __attribute__((noreturn));
+
+// Lexical errors end the compilation, the token stream ends there too
+static void lexical_error(CompilerContext *ctx, const char *fmt, ...)
+{
+	Scanner *s = &ctx->scanner;
+	va_list arg;
+	va_start(arg, fmt);
+	vsnprintf(s->error_message, sizeof(s->error_message), fmt, arg);
+	va_end(arg);
+	raise_error(ctx, true);
+}
+
+// Counts the columns of the line up to 'at' from 1
+static int column_at(const Scanner *s, const char *at)
+{
+	const char *line_start = at;
+
+	while (line_start > s->source && line_start[-1] != '\n')
+		line_start--;
+
+	return (int)(at - line_start) + 1;
+}
+
+static TokenKind scan_identifier(Scanner *s)
+{
+	assert(is_ident(s->ch));
+	// identifier, from the current character on
+	const char *start = s->current - 1;
+	const char *end = skip_ident_chars(s->current);
+	int i = (int)(end - start);
+
+	if (i > MAX_STRLEN - 1)
+		i = MAX_STRLEN - 1;
+
+	memcpy(s->identifier, start, i);
+	s->identifier[i] = '\0';
+	s->current = end;
+	s->ch = get_char(s);
+
+	// keyword
+	const unsigned char *name = (const unsigned char *)s->identifier;
+	const struct KeywordEntry *keyword = &g_keyword_table[KEYWORD_HASH(name[0], name[i - 1], i)];
+
+	if (keyword->length == i && memcmp(keyword->identifier, s->identifier, i) == 0)
+		return keyword->kind;
+
+	s->atom = atom_intern(&s->atoms, s->identifier, i);
 	return TK_IDENTIFIER;
 }
 
-static TokenKind scan_decimal_number(void)
+static TokenKind scan_decimal_number(CompilerContext *ctx)
 {
-	assert(is_digit(g_ch));
+	Scanner *s = &ctx->scanner;
+	assert(is_digit(s->ch));
 	long long value = 0;
 
 	do {
 		if (value > INT_MIN && value < INT_MAX) {
-			value = 10 * value + g_ch - '0';
+			value = 10 * value + s->ch - '0';
 		} else {
-			scanner_mark_error("number too large for int");
+			lexical_error(ctx, "number too large for int");
 			value = 0;
 		}
 
-		g_ch = get_char();
-	} while (g_ch >= '0' && g_ch <= '9');
+		s->ch = get_char(s);
+	} while (s->ch >= '0' && s->ch <= '9');
 
-	g_number = (int)value;
+	s->number = (int)value;
 	return TK_LITERAL_NUMBER;
 }
 
-static TokenKind scan_hex_number(void)
+static TokenKind scan_hex_number(CompilerContext *ctx)
 {
-	assert(is_xdigit(g_ch));
+	Scanner *s = &ctx->scanner;
+	assert(is_xdigit(s->ch));
 	long long value = 0;
 
 	do {
 		if (value > INT_MIN && value < INT_MAX) {
-			value = 16 * value + get_xdigit_value(g_ch);
+			value = 16 * value + get_xdigit_value(s->ch);
 		} else {
-			scanner_mark_error("number too large for int");
+			lexical_error(ctx, "number too large for int");
 			value = 0;
 		}
 
-		g_ch = get_char();
-	} while (is_xdigit(g_ch));
+		s->ch = get_char(s);
+	} while (is_xdigit(s->ch));
 
-	g_number = (int)value;
+	s->number = (int)value;
 	return TK_LITERAL_NUMBER;
 }
 
-static void skip_comment(void)
+static void skip_comment(CompilerContext *ctx)
 {
-	assert(g_ch == '*');
-
-	do {
-		// nested comments possible!
-		do {
-			g_ch = get_char();
-
-			while (g_ch == '(') {
-				g_ch = get_char();
-
-				if (g_ch == '*')
-					skip_comment();
-			}
-		} while (g_ch != '*' || g_ch == '\0');
+	Scanner *s = &ctx->scanner;
+	assert(s->ch == '*');
+	const char *p = s->current;
+	int depth = 1; // nested comments possible!
+
+	while (depth > 0) {
+		p = find_comment_mark(p);
+
+		if (*p == '\0') {
+			s->current = p;
+			s->ch = '\0';
+			lexical_error(ctx, "comment not terminated");
+		}
 
-		do {
-			g_ch = get_char();
-		} while (g_ch == '*' || g_ch == '\0');
-	} while (g_ch != ')' || g_ch == '\0');
+		if (p[0] == '(' && p[1] == '*') {
+			depth += 1;
+			p += 2;
+		} else if (p[0] == '*' && p[1] == ')') {
+			depth -= 1;
+			p += 2;
+		} else {
+			p += 1;
+		}
+	}
 
-	if (g_ch != '\0')
-		g_ch = get_char();
-	else
-		scanner_mark_error("comment not terminated");
+	s->current = p;
+	s->ch = get_char(s);
 }
 
-static void skip_line_comment(void)
+static void skip_line_comment(Scanner *s)
 {
-	assert(g_ch == '/');
-
-	while (g_ch != '\n' && g_ch != '\0')
-		g_ch = get_char();
+	assert(s->ch == '/');
+	s->current = find_line_end(s->current);
+	s->ch = get_char(s);
 }
 
-inline static void skip_whitespace(void)
+inline static void skip_whitespace(Scanner *s)
 {
-	while (true) {
-		switch (g_ch) {
-		case '\n':
-		case ' ':
-		case '\r':
-		case '\t':
-			g_ch = get_char();
-			break;
-
-		default:
-			return;
-		}
+	if (has_char_class(s->ch, CHAR_SPACE)) {
+		s->current = skip_space_chars(s->current);
+		s->ch = get_char(s);
 	}
 }
 
-
-TokenKind scanner_get(void)
+static TokenKind scan_token(CompilerContext *ctx)
 {
-	skip_whitespace();
+	Scanner *s = &ctx->scanner;
+	skip_whitespace(s);
 
-	if (g_ch == '\0')
+	if (s->ch == '\0') {
+		s->token_start = s->current;
 		return TK_EOF;
+	}
 
+	s->token_start = s->current - 1;
 	TokenKind kind = TK_UNKNOWN;
 
-	if (is_ident_start(g_ch))
-		kind = scan_identifier();
-	else if (is_digit(g_ch))
-		kind = scan_decimal_number();
+	if (is_ident_start(s->ch))
+		kind = scan_identifier(s);
+	else if (is_digit(s->ch))
+		kind = scan_decimal_number(ctx);
 	else {
-		switch (g_ch) {
+		switch (s->ch) {
 			break;
 
 		case '!':
-			g_ch = get_char();
-			kind = scan_hex_number();
+			s->ch = get_char(s);
+			kind = scan_hex_number(ctx);
 			break;
 
 		case '&':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_LOGIC_AND;
 			break;
 
 		case '*':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_TIMES;
 			break;
 
 		case '+':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_PLUS;
 			break;
 
 		case '-':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_MINUS;
 			break;
 
 		case '=':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_EQUAL;
 			break;
 
 		case '#':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_NOT_EQUAL;
 			break;
 
 		case ';':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_SEMICOLON;
 			break;
 
 		case ',':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_COMMA;
 			break;
 
 		case '.':
-			g_ch = get_char();
-			kind = TK_PERIOD;
+			s->ch = get_char(s);
+
+			if (s->ch == '.') {
+				kind = TK_UPTO;
+				s->ch = get_char(s);
+			} else {
+				kind = TK_PERIOD;
+			}
+
+			break;
+
+		case '|':
+			s->ch = get_char(s);
+			kind = TK_BAR;
 			break;
 
 		case '[':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_LEFT_BRACKET;
 			break;
 
 		case ']':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_RIGHT_BRACKET;
 			break;
 
 		case '~':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_LOGIC_NOT;
 			break;
 
 		case '<':
-			g_ch = get_char();
+			s->ch = get_char(s);
 
-			if (g_ch == '=') {
+			if (s->ch == '=') {
 				kind = TK_LESS_EQUAL;
-				g_ch = get_char();
+				s->ch = get_char(s);
 			} else {
 				kind = TK_LESS;
 			}
@@ -285,11 +504,11 @@ TokenKind scanner_get(void)
 			break;
 
 		case '>':
-			g_ch = get_char();
+			s->ch = get_char(s);
 
-			if (g_ch == '=') {
+			if (s->ch == '=') {
 				kind = TK_GREATER_EQUAL;
-				g_ch = get_char();
+				s->ch = get_char(s);
 			} else {
 				kind = TK_GREATER;
 			}
@@ -297,11 +516,11 @@ TokenKind scanner_get(void)
 			break;
 
 		case ':':
-			g_ch = get_char();
+			s->ch = get_char(s);
 
-			if (g_ch == '=') {
+			if (s->ch == '=') {
 				kind = TK_ASSIGN;
-				g_ch = get_char();
+				s->ch = get_char(s);
 			} else {
 				kind = TK_COLON;
 			}
@@ -309,16 +528,16 @@ TokenKind scanner_get(void)
 			break;
 
 		case ')':
-			g_ch = get_char();
+			s->ch = get_char(s);
 			kind = TK_RIGHT_PAREN;
 			break;
 
 		case '(':
-			g_ch = get_char();
+			s->ch = get_char(s);
 
-			if (g_ch == '*') {
-				skip_comment();
-				kind = scanner_get();
+			if (s->ch == '*') {
+				skip_comment(ctx);
+				kind = scan_token(ctx);
 			} else {
 				kind = TK_LEFT_PAREN;
 			}
@@ -326,13 +545,13 @@ TokenKind scanner_get(void)
 			break;
 
 		case '/':
-			g_ch = get_char();
+			s->ch = get_char(s);
 
-			if (g_ch == '/') {
-				skip_line_comment();
-				kind = scanner_get();
+			if (s->ch == '/') {
+				skip_line_comment(s);
+				kind = scan_token(ctx);
 			} else {
-				unget_char();
+				unget_char(s);
 			}
 
 			break;
@@ -345,41 +564,659 @@ TokenKind scanner_get(void)
 	return kind;
 }
 
-void scanner_init(const char *source)
+static void append_token(TokenStream *tokens, TokenKind kind, size_t start, int value)
+{
+	if (tokens->count >= tokens->capacity) {
+		int capacity = tokens->capacity ? 2 * tokens->capacity : 4096;
+		unsigned char *kinds = realloc(tokens->kinds, capacity * sizeof(*kinds));
+		uint32_t *starts = realloc(tokens->starts, capacity * sizeof(*starts));
+		int *values = realloc(tokens->values, capacity * sizeof(*values));
+
+		if (kinds)
+			tokens->kinds = kinds;
+
+		if (starts)
+			tokens->starts = starts;
+
+		if (values)
+			tokens->values = values;
+
+		if (!kinds || !starts || !values)
+			abort(); // out of memory
+
+		tokens->capacity = capacity;
+	}
+
+	tokens->kinds[tokens->count] = (unsigned char)kind;
+	tokens->starts[tokens->count] = (uint32_t)start;
+	tokens->values[tokens->count] = value;
+	tokens->count += 1;
+}
+
+static int token_value(const Scanner *s, TokenKind kind)
+{
+	if (kind == TK_IDENTIFIER)
+		return s->atom;
+
+	return kind == TK_LITERAL_NUMBER ? s->number : 0;
+}
+
+// 'at' is the offset of the error
+static void append_error_token(Scanner *s, int error_line, size_t at, const char *message)
+{
+	s->tokens.error_at = s->tokens.count;
+	s->tokens.error_line = error_line;
+	string_copy(s->tokens.error_message, message);
+	append_token(&s->tokens, TK_UNKNOWN, at, 0);
+}
+
+/*
+ * Parallel lexing: the source is cut into chunks at line starts, which
+ * no token spans. Each chunk is lexed on its own thread with a private
+ * scanner and atom table, assuming it doesn't start inside a comment.
+ * The chunks are then stitched in order. A chunk is right if its first
+ * token starts where the lexing of the previous chunk stopped, because
+ * the tokens from a token start on don't depend on what came before.
+ * Otherwise a comment spans the boundary and the chunk is lexed again
+ * from there.
+ */
+enum { MinChunkSize = 1 << 20 };
+
+typedef struct {
+	CompilerContext *lexer;  // only its scanner is used
+	size_t           begin;  // lexing starts here
+	size_t           end;    // for the tokens starting before
+	size_t           first;  // start of the first token
+	size_t           stop;   // start of the first token from end on
+	bool             error;
+	size_t           error_at;
+	Atom            *atoms;  // local atom to the atom of the context, 0 if not yet known
+	int              atom_capacity;
+} LexChunk;
+
+static void lex_chunk(LexChunk *chunk, const char *source)
+{
+	CompilerContext *ctx = chunk->lexer;
+	Scanner *s = &ctx->scanner;
+	scanner_init(ctx, source); // lines are counted from the start of the source
+	s->current = source + chunk->begin;
+	s->ch = get_char(s);
+	s->tokens.count = 0;
+	s->lexing = true;
+	chunk->first = SIZE_MAX;
+	chunk->error = false;
+
+	if (setjmp(s->lex_abort) == 0) {
+		while (true) {
+			TokenKind kind = scan_token(ctx);
+			size_t start = s->token_start - source;
+
+			if (chunk->first == SIZE_MAX)
+				chunk->first = start;
+
+			if (kind == TK_EOF || start >= chunk->end) {
+				chunk->stop = start;
+				break;
+			}
+
+			append_token(&s->tokens, kind, start, token_value(s, kind));
+		}
+	} else {
+		size_t start = s->token_start - source;
+
+		if (chunk->first == SIZE_MAX)
+			chunk->first = start;
+
+		// an error in a token of the next chunk is found there
+		if (start >= chunk->end) {
+			chunk->stop = start;
+		} else {
+			chunk->error = true;
+			chunk->error_at = s->current - source;
+		}
+	}
+
+	s->lexing = false;
+}
+
+typedef struct {
+	LexChunk   *chunk;
+	const char *source;
+} LexJob;
+
+static void *lex_worker(void *argument)
+{
+	LexJob *job = argument;
+	lex_chunk(job->chunk, job->source);
+	return NULL;
+}
+
+// Appends the tokens of a chunk with their atoms entered in the context
+static void stitch_chunk(CompilerContext *ctx, LexChunk *chunk)
+{
+	Scanner *s = &ctx->scanner;
+	Scanner *local = &chunk->lexer->scanner;
+	int local_atoms = atom_count(&local->atoms);
+
+	if (local_atoms > chunk->atom_capacity) {
+		chunk->atoms = realloc(chunk->atoms, local_atoms * sizeof(*chunk->atoms));
+
+		if (!chunk->atoms)
+			abort(); // out of memory
+
+		memset(chunk->atoms + chunk->atom_capacity, 0,
+		       (local_atoms - chunk->atom_capacity) * sizeof(*chunk->atoms));
+		chunk->atom_capacity = local_atoms;
+	}
+
+	for (int i = 0; i < local->tokens.count; i++) {
+		int value = local->tokens.values[i];
+
+		if (local->tokens.kinds[i] == TK_IDENTIFIER) {
+			if (chunk->atoms[value] == 0)
+				chunk->atoms[value] = scanner_intern(ctx, atom_name(&local->atoms, value));
+
+			value = chunk->atoms[value];
+		}
+
+		append_token(&s->tokens, local->tokens.kinds[i], local->tokens.starts[i], value);
+	}
+}
+
+static void tokenize_parallel(CompilerContext *ctx, size_t length, int threads)
+{
+	Scanner *s = &ctx->scanner;
+	const char *source = s->source;
+	LexChunk *chunks = calloc(threads, sizeof(*chunks));
+	LexJob *jobs = calloc(threads, sizeof(*jobs));
+	pthread_t *workers = calloc(threads, sizeof(*workers));
+	size_t begin = 0;
+
+	for (int i = 0; i < threads; i++) {
+		size_t end = length;
+		size_t target = (i + 1) * (length / threads);
+
+		if (i + 1 < threads && target > begin) {
+			const char *line_end = memchr(source + target, '\n', length - target);
+			end = line_end ? (size_t)(line_end + 1 - source) : length;
+		} else if (i + 1 < threads) {
+			end = begin; // the line of the previous chunk reaches beyond
+		}
+
+		chunks[i].lexer = calloc(1, sizeof(CompilerContext));
+		chunks[i].begin = begin;
+		chunks[i].end = end;
+		jobs[i].chunk = &chunks[i];
+		jobs[i].source = source;
+		begin = end;
+	}
+
+	for (int i = 1; i < threads; i++)
+		pthread_create(&workers[i], NULL, lex_worker, &jobs[i]);
+
+	lex_chunk(&chunks[0], source);
+
+	for (int i = 1; i < threads; i++)
+		pthread_join(workers[i], NULL);
+
+	s->tokens.count = 0;
+	s->tokens.error_at = -1;
+	size_t stop = 0;
+	bool done = false;
+
+	for (int i = 0; i < threads && !done; i++) {
+		LexChunk *chunk = &chunks[i];
+
+		if (chunk->first != stop) {
+			chunk->begin = stop;
+			lex_chunk(chunk, source);
+		}
+
+		stitch_chunk(ctx, chunk);
+
+		if (chunk->error) {
+			Scanner *local = &chunk->lexer->scanner;
+			append_error_token(s, local->error_line, chunk->error_at, local->error_message);
+			done = true;
+		}
+
+		stop = chunk->stop;
+	}
+
+	if (!done)
+		append_token(&s->tokens, TK_EOF, stop, 0);
+
+	for (int i = 0; i < threads; i++) {
+		scanner_release(chunks[i].lexer);
+		free(chunks[i].lexer);
+		free(chunks[i].atoms);
+	}
+
+	free(workers);
+	free(jobs);
+	free(chunks);
+}
+
+// Lexes the whole source. A lexical error ends the stream with a token
+// that raises the error when the parser gets to it, as without the stream.
+// Sources too large for the offsets are scanned as they are parsed.
+static void tokenize(CompilerContext *ctx)
+{
+	Scanner *s = &ctx->scanner;
+	TokenStream *tokens = &s->tokens;
+	TokenKind kind = TK_UNKNOWN;
+	tokens->count = 0;
+	tokens->error_at = -1;
+
+	if (s->lex_threads > 1) {
+		size_t length = strlen(s->source);
+		int threads = s->lex_threads;
+
+		if (length > UINT32_MAX)
+			return;
+
+		if (length / threads < MinChunkSize)
+			threads = (int)(length / MinChunkSize);
+
+		if (threads > 1) {
+			tokenize_parallel(ctx, length, threads);
+			return;
+		}
+	}
+
+	s->lexing = true;
+
+	if (setjmp(s->lex_abort) == 0) {
+		do {
+			kind = scan_token(ctx);
+
+			if ((size_t)(s->current - s->source) > UINT32_MAX) {
+				tokens->count = 0;
+				break;
+			}
+
+			append_token(tokens, kind, s->token_start - s->source, token_value(s, kind));
+		} while (kind != TK_EOF);
+	} else {
+		append_error_token(s, s->error_line, s->current - s->source, s->error_message);
+	}
+
+	s->lexing = false;
+}
+
+/*
+ * Pipelined lexing: a thread of its own lexes the source with a private
+ * scanner and atom table and passes the tokens through a ring. The
+ * parser takes them into the token stream as it needs them, so lookahead
+ * works as with a pretokenized source. Atoms are entered in the context
+ * on the parser's side, from the name in the source, as the private
+ * atom table may be growing meanwhile.
+ */
+enum { PipeCapacity = 1 << 14 };
+
+typedef struct {
+	uint32_t       start;  // of the error of an error token
+	int            value;  // private atom of an identifier, value of a number
+	unsigned short length; // of the name of an identifier, as it is interned
+	unsigned char  kind;
+	bool           error;  // ends the ring, see TokenPipe
+} PipeToken;
+
+struct TokenPipe {
+	CompilerContext *lexer;      // only its scanner is used
+	Ring             ring;       // of PipeToken
+	pthread_t        thread;
+	bool             done;       // the last token has been taken
+	Atom            *atoms;      // private atom to the atom of the context, 0 if not yet known
+	int              atom_capacity;
+	int              error_line; // of the error token, set before it is pushed
+	char             error_message[MAX_STRLEN];
+};
+
+// Returns false once the parser is done
+static bool push_token(TokenPipe *pipe, PipeToken token)
+{
+	PipeToken *slot = ring_reserve(&pipe->ring);
+
+	if (!slot)
+		return false;
+
+	*slot = token;
+	ring_push(&pipe->ring);
+	return true;
+}
+
+static void *pipe_worker(void *argument)
+{
+	TokenPipe *pipe = argument;
+	Scanner *s = &pipe->lexer->scanner;
+	const char *source = s->source;
+	s->lexing = true;
+
+	if (setjmp(s->lex_abort) == 0) {
+		TokenKind kind;
+
+		do {
+			kind = scan_token(pipe->lexer);
+
+			if ((size_t)(s->current - source) > UINT32_MAX)
+				lexical_error(pipe->lexer, "source too large");
+
+			int length = kind == TK_IDENTIFIER ? string_length(s->identifier) : 0;
+			PipeToken token = {s->token_start - source, token_value(s, kind), length, kind, false};
+
+			if (!push_token(pipe, token))
+				break;
+		} while (kind != TK_EOF);
+	} else {
+		pipe->error_line = s->error_line;
+		string_copy(pipe->error_message, s->error_message);
+		size_t at = s->current - source;
+		PipeToken token = {at > UINT32_MAX ? UINT32_MAX : at, 0, 0, TK_UNKNOWN, true};
+		push_token(pipe, token);
+	}
+
+	s->lexing = false;
+	ring_close(&pipe->ring);
+	return NULL;
+}
+
+static void start_pipe(CompilerContext *ctx)
+{
+	Scanner *s = &ctx->scanner;
+	TokenPipe *pipe = calloc(1, sizeof(*pipe));
+	CompilerContext *lexer = calloc(1, sizeof(*lexer));
+
+	if (!pipe || !lexer)
+		abort(); // out of memory
+
+	scanner_init(lexer, s->source);
+	ring_init(&pipe->ring, sizeof(PipeToken), PipeCapacity);
+	pipe->lexer = lexer;
+	s->pipe = pipe;
+	s->tokens.count = 0;
+	s->tokens.error_at = -1;
+
+	if (pthread_create(&pipe->thread, NULL, pipe_worker, pipe) != 0)
+		abort();
+}
+
+// Appends the next token of the ring to the stream, waiting for it
+static void pull_token(CompilerContext *ctx)
+{
+	Scanner *s = &ctx->scanner;
+	TokenPipe *pipe = s->pipe;
+	PipeToken *token = pipe->done ? NULL : ring_peek(&pipe->ring);
+
+	if (!token)
+		return;
+
+	int value = token->value;
+
+	if (token->error) {
+		append_error_token(s, pipe->error_line, token->start, pipe->error_message);
+		pipe->done = true;
+	} else if (token->kind == TK_IDENTIFIER) {
+		if (value >= pipe->atom_capacity) {
+			int capacity = pipe->atom_capacity ? 2 * pipe->atom_capacity : 1024;
+
+			while (capacity <= value)
+				capacity *= 2;
+
+			pipe->atoms = realloc(pipe->atoms, capacity * sizeof(*pipe->atoms));
+
+			if (!pipe->atoms)
+				abort(); // out of memory
+
+			memset(pipe->atoms + pipe->atom_capacity, 0,
+			       (capacity - pipe->atom_capacity) * sizeof(*pipe->atoms));
+			pipe->atom_capacity = capacity;
+		}
+
+		if (pipe->atoms[value] == 0) {
+			const char *name = s->source + token->start;
+			pipe->atoms[value] = atom_intern(&s->atoms, name, token->length);
+		}
+
+		append_token(&s->tokens, TK_IDENTIFIER, token->start, pipe->atoms[value]);
+	} else {
+		append_token(&s->tokens, token->kind, token->start, value);
+		pipe->done = token->kind == TK_EOF;
+	}
+
+	ring_pop(&pipe->ring);
+}
+
+void scanner_finish(CompilerContext *ctx)
+{
+	TokenPipe *pipe = ctx->scanner.pipe;
+
+	if (!pipe)
+		return;
+
+	ring_cancel(&pipe->ring);
+	pthread_join(pipe->thread, NULL);
+	ring_free(&pipe->ring);
+	scanner_release(pipe->lexer);
+	free(pipe->lexer);
+	free(pipe->atoms);
+	free(pipe);
+	ctx->scanner.pipe = NULL;
+}
+
+TokenKind scanner_get(CompilerContext *ctx)
+{
+	Scanner *s = &ctx->scanner;
+
+	if (s->pipe && s->token + 1 >= s->tokens.count)
+		pull_token(ctx);
+	else if (s->tokens.count == 0)
+		return scan_token(ctx);
+
+	TokenStream *tokens = &s->tokens;
+
+	if (s->token + 1 < tokens->count)
+		s->token += 1;
+
+	if (s->token == tokens->error_at) {
+		const char *at = s->source + tokens->starts[s->token];
+		diagnostics_add(&s->diagnostics, tokens->error_line, column_at(s, at),
+		                tokens->error_message);
+		longjmp(ctx->abort, 1);
+	}
+
+	TokenKind kind = tokens->kinds[s->token];
+
+	if (kind == TK_IDENTIFIER)
+		s->atom = tokens->values[s->token];
+	else if (kind == TK_LITERAL_NUMBER)
+		s->number = tokens->values[s->token];
+
+	return kind;
+}
+
+void scanner_release(CompilerContext *ctx)
+{
+	TokenStream *tokens = &ctx->scanner.tokens;
+	scanner_finish(ctx);
+	atom_release(&ctx->scanner.atoms);
+	diagnostics_release(&ctx->scanner.diagnostics);
+	free(tokens->kinds);
+	free(tokens->starts);
+	free(tokens->values);
+	memset(tokens, 0, sizeof(*tokens));
+}
+
+void scanner_set_pretokenize(CompilerContext *ctx, bool pretokenize)
+{
+	ctx->scanner.pretokenize = pretokenize;
+}
+
+void scanner_set_lex_threads(CompilerContext *ctx, int threads)
 {
-	g_current = source;
-	g_number = -1;
-	g_error = false;
-	g_line = 1;
-	g_ch = get_char();
+	ctx->scanner.lex_threads = threads;
 }
 
+void scanner_set_pipeline(CompilerContext *ctx, bool pipeline)
+{
+	ctx->scanner.pipeline = pipeline;
+}
 
-const char *scanner_get_identifier(void)
+void scanner_init(CompilerContext *ctx, const char *source)
 {
-	return g_identifier;
+	Scanner *s = &ctx->scanner;
+	s->source = source;
+	s->current = source;
+	s->number = -1;
+	s->atom = 0;
+	s->error_line = 0;
+	s->error_message[0] = '\0';
+	s->error_offset = 0;
+	diagnostics_clear(&s->diagnostics);
+	s->line = 1;
+	s->line_counted = source;
+	s->token_start = source;
+	s->ch = get_char(s);
+	s->tokens.count = 0;
+	s->token = -1;
+
+	if (s->pipeline) {
+		start_pipe(ctx);
+	} else if (s->pretokenize) {
+		double start = compiler_clock();
+		tokenize(ctx);
+		ctx->stats.seconds[CP_LEX] = compiler_clock() - start;
+		s->number = -1;
+		s->atom = 0;
+
+		if (s->tokens.count == 0) {
+			// too large, scan from the start again
+			s->current = source;
+			s->line_counted = source;
+			s->ch = get_char(s);
+		}
+	}
 }
 
-int scanner_get_number(void)
+void scanner_save(CompilerContext *ctx, ScannerPosition *position)
 {
-	int result = g_number;
+	Scanner *s = &ctx->scanner;
+	position->current = s->current;
+	position->ch = s->ch;
+	position->line = s->line;
+	position->line_counted = s->line_counted;
+	position->token_start = s->token_start;
+	position->token = s->token;
+	position->number = s->number;
+	position->atom = s->atom;
+}
+
+void scanner_restore(CompilerContext *ctx, const ScannerPosition *position)
+{
+	Scanner *s = &ctx->scanner;
+	s->current = position->current;
+	s->ch = position->ch;
+	s->line = position->line;
+	s->line_counted = position->line_counted;
+	s->token_start = position->token_start;
+	s->token = position->token;
+	s->number = position->number;
+	s->atom = position->atom;
+}
+
+Atom scanner_get_atom(CompilerContext *ctx)
+{
+	return ctx->scanner.atom;
+}
+
+Atom scanner_intern(CompilerContext *ctx, const char *name)
+{
+	return atom_intern(&ctx->scanner.atoms, name, string_length(name));
+}
+
+const char *scanner_atom_name(CompilerContext *ctx, Atom atom)
+{
+	return atom_name(&ctx->scanner.atoms, atom);
+}
+
+int scanner_get_number(CompilerContext *ctx)
+{
+	int result = ctx->scanner.number;
 	assert(result >= 0);
 	return result;
 }
 
-void scanner_mark_error(const char *fmt, ...)
+static const char *current_token(const Scanner *s)
+{
+	if (s->tokens.count > 0)
+		return s->source + (s->token >= 0 ? s->tokens.starts[s->token] : 0);
+
+	return s->token_start;
+}
+
+// Records the error at 'at', unless an error has been recorded there or
+// behind it already, which it most likely follows from. Returns false once
+// the error limit is reached.
+static bool record_error(CompilerContext *ctx, const char *at)
+{
+	Scanner *s = &ctx->scanner;
+	s->error_line = line_at(s, at);
+	size_t offset = at - s->source;
+
+	if (s->diagnostics.count > 0 && offset <= s->error_offset)
+		return true;
+
+	s->error_offset = offset;
+	return diagnostics_add(&s->diagnostics, s->error_line, column_at(s, at), s->error_message);
+}
+
+// The message is in error_message. Lexical errors are located where the
+// scanner stopped, the others at the current token.
+static void raise_error(CompilerContext *ctx, bool lexical)
+{
+	Scanner *s = &ctx->scanner;
+
+	if (s->lexing) {
+		s->error_line = line_at(s, s->current);
+		longjmp(s->lex_abort, 1);
+	}
+
+	if (record_error(ctx, lexical ? s->current : current_token(s)) && !lexical && ctx->recover)
+		longjmp(*ctx->recover, 1);
+
+	longjmp(ctx->abort, 1);
+}
+
+// Records the error and continues at the parser's recovery point, see
+// compiler_compile
+void scanner_mark_error(CompilerContext *ctx, const char *fmt, ...)
+{
+	Scanner *s = &ctx->scanner;
+	va_list arg;
+	va_start(arg, fmt);
+	vsnprintf(s->error_message, sizeof(s->error_message), fmt, arg);
+	va_end(arg);
+	raise_error(ctx, false);
+}
+
+void scanner_report_error(CompilerContext *ctx, const char *fmt, ...)
 {
+	Scanner *s = &ctx->scanner;
 	va_list arg;
-	printf("ERROR at line %d: ", g_line);
 	va_start(arg, fmt);
-	vprintf(fmt, arg);
+	vsnprintf(s->error_message, sizeof(s->error_message), fmt, arg);
 	va_end(arg);
-	printf("\n");
-	g_error = true;
-	exit(EXIT_FAILURE);
+
+	if (!record_error(ctx, current_token(s)))
+		longjmp(ctx->abort, 1);
+}
+
+bool scanner_has_error(CompilerContext *ctx)
+{
+	return ctx->scanner.diagnostics.count > 0;
 }
 
-bool scanner_has_error(void)
+void scanner_set_error_limit(CompilerContext *ctx, int limit)
 {
-	return g_error;
+	ctx->scanner.diagnostics.limit = limit;
 }
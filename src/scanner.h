@@ -1,8 +1,17 @@
 #ifndef LEXER_H
 #define LEXER_H
+#include "utils.h"
+#include "atoms.h"
+#include "diagnostics.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <setjmp.h>
 #ifndef __cplusplus
 typedef enum TokenKind TokenKind;
+typedef struct Scanner Scanner;
+typedef struct ScannerPosition ScannerPosition;
+typedef struct TokenPipe TokenPipe;
+typedef struct CompilerContext CompilerContext;
 #endif
 
 /*
@@ -32,11 +41,14 @@ enum TokenKind {
 	TK_PERIOD,        // period    '.'
 	TK_COMMA,         // comma     ','
 	TK_COLON,         // colon     ':'
+	TK_UPTO,          // upto      '..'
 	TK_RIGHT_PAREN,   // rparen    ')'
 	TK_RIGHT_BRACKET, // rbrak     ']'
 	TK_KEY_OF,        // of        'of'
 	TK_KEY_THEN,      // then      'then'
 	TK_KEY_DO,        // do        'do'
+	TK_KEY_TO,        // to        'to'
+	TK_KEY_BY,        // by        'by'
 	TK_LEFT_PAREN,    // lparen    '('
 	TK_LEFT_BRACKET,  // lbrak     '['
 	TK_LOGIC_NOT,     // not       '~'
@@ -45,12 +57,15 @@ enum TokenKind {
 	TK_IDENTIFIER,    // ident
 	TK_SEMICOLON,     // semicolon ';'
 	TK_KEY_END,       // end       'end'
+	TK_BAR,           // bar       '|'
 	TK_KEY_ELSE,      // eise      'else'
 	TK_KEY_ELSEIF,    // elsif     'elsif'
 	TK_KEY_UNTIL,     // until     'until'
 	TK_KEY_IF,        // if        'if'
+	TK_KEY_CASE,      // case      'case'
 	TK_KEY_WHILE,     // while,    'while'
 	TK_KEY_REPEAT,    // repeat    'repeat'
+	TK_KEY_FOR,       // for       'for'
 	TK_KEY_ARRAY,     // array     'array'
 	TK_KEY_RECORD,    // record    'record'
 	TK_KEY_CONST,     // const     'const'
@@ -66,11 +81,75 @@ enum TokenKind {
 // comment start '(*'
 // commment end  '*)'
 
-void        scanner_init(const char *source);
-TokenKind   scanner_get(void);
-int         scanner_get_number(void);
-const char *scanner_get_identifier(void);
-void        scanner_mark_error(const char *fmt, ...);
-bool        scanner_has_error(void);
+// The whole source lexed ahead, one array per column of the tokens
+typedef struct {
+	unsigned char *kinds;    // TokenKind
+	uint32_t      *starts;   // source offset of the token, for error positions
+	int           *values;   // atom of an identifier, value of a number
+	int            count;
+	int            capacity;
+	int            error_at; // token replaying a lexical error, -1 if none
+	int            error_line;
+	char           error_message[MAX_STRLEN];
+} TokenStream;
+
+struct Scanner {
+	const char *source;
+	const char *current;
+	char        ch;
+	int         line;         // of line_counted
+	const char *line_counted; // lines are counted up to here, see line_at
+	const char *token_start;
+	int         number;
+	Atom        atom; // of the last identifier
+	char        identifier[MAX_STRLEN];
+	AtomTable   atoms; // kept for all compilations of a context
+	bool        pretokenize; // lex the whole source into tokens first
+	int         lex_threads; // for large sources, 1 or less lexes in one
+	bool        pipeline;    // lex on a thread of its own while parsing
+	TokenPipe  *pipe;        // from that thread, while a compilation runs
+	TokenStream tokens;      // kept for all compilations of a context
+	int         token;       // the current one in tokens
+	bool        lexing;      // ahead, errors are deferred to lex_abort
+	jmp_buf     lex_abort;
+	int         error_line;    // of the error raised last
+	char        error_message[MAX_STRLEN];
+	size_t      error_offset;  // of the error recorded last
+	Diagnostics diagnostics;   // of the compilation
+};
+
+// Everything needed to scan again from a previous token on
+struct ScannerPosition {
+	const char *current;
+	char        ch;
+	int         line;
+	const char *line_counted;
+	const char *token_start;
+	int         token;
+	int         number;
+	Atom        atom;
+};
+
+void        scanner_release(CompilerContext *ctx);
+void        scanner_set_pretokenize(CompilerContext *ctx, bool pretokenize);
+void        scanner_set_lex_threads(CompilerContext *ctx, int threads);
+void        scanner_set_pipeline(CompilerContext *ctx, bool pipeline);
+void        scanner_init(CompilerContext *ctx, const char *source);
+void        scanner_finish(CompilerContext *ctx); // after parsing, stops the lexing thread
+void        scanner_save(CompilerContext *ctx, ScannerPosition *position);
+void        scanner_restore(CompilerContext *ctx, const ScannerPosition *position);
+TokenKind   scanner_get(CompilerContext *ctx);
+int         scanner_get_number(CompilerContext *ctx);
+Atom        scanner_get_atom(CompilerContext *ctx);
+Atom        scanner_intern(CompilerContext *ctx, const char *name);
+const char *scanner_atom_name(CompilerContext *ctx, Atom atom); // see atom_name
+// Records an error and continues at the innermost recovery point of the
+// parser, see CompilerContext. Without one, or once the error limit is
+// reached, the compilation is abandoned.
+void        scanner_mark_error(CompilerContext *ctx, const char *fmt, ...);
+// Records an error and returns, for callers that recover by themselves
+void        scanner_report_error(CompilerContext *ctx, const char *fmt, ...);
+bool        scanner_has_error(CompilerContext *ctx);
+void        scanner_set_error_limit(CompilerContext *ctx, int limit);
 
 #endif // LEXER_H
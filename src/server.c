@@ -0,0 +1,324 @@
+#include "server.h"
+#include "compiler.h"
+#include "utils.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const size_t MaxSourceSize = 64 * 1024 * 1024;
+
+// Idle compiler contexts, taken by a connection for its lifetime
+typedef struct PooledContext PooledContext;
+struct PooledContext {
+	CompilerContext *ctx;
+	PooledContext   *next;
+};
+
+static PooledContext  *g_pool = NULL;
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static ServerOptions   g_options;
+
+static PooledContext *acquire_context(void)
+{
+	pthread_mutex_lock(&g_pool_lock);
+	PooledContext *pooled = g_pool;
+
+	if (pooled)
+		g_pool = pooled->next;
+
+	pthread_mutex_unlock(&g_pool_lock);
+
+	if (!pooled) {
+		pooled = malloc(sizeof(*pooled));
+		pooled->ctx = compiler_create();
+
+		if (g_options.unroll_factor > 0)
+			compiler_set_unroll_factor(pooled->ctx, g_options.unroll_factor);
+
+		compiler_set_pretokenize(pooled->ctx, g_options.pretokenize);
+
+		if (g_options.lex_threads > 0)
+			compiler_set_lex_threads(pooled->ctx, g_options.lex_threads);
+
+		compiler_set_pipeline(pooled->ctx, g_options.pipeline);
+
+		if (g_options.error_limit > 0)
+			compiler_set_error_limit(pooled->ctx, g_options.error_limit);
+	}
+
+	return pooled;
+}
+
+static void release_context(PooledContext *pooled)
+{
+	pthread_mutex_lock(&g_pool_lock);
+	pooled->next = g_pool;
+	g_pool = pooled;
+	pthread_mutex_unlock(&g_pool_lock);
+}
+
+// Buffered reading from the connection
+typedef struct {
+	int  fd;
+	int  start;
+	int  end;
+	char buffer[4096];
+} Reader;
+
+static bool fill(Reader *reader)
+{
+	while (true) {
+		ssize_t n = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		reader->start = 0;
+		reader->end = (int)n;
+		return true;
+	}
+}
+
+// Reads a line without its '\n', false at the end of the connection
+static bool read_line(Reader *reader, char *line, int size)
+{
+	int length = 0;
+
+	while (true) {
+		if (reader->start == reader->end && !fill(reader))
+			return false;
+
+		char c = reader->buffer[reader->start++];
+
+		if (c == '\n')
+			break;
+
+		if (length + 1 < size)
+			line[length++] = c;
+	}
+
+	line[length] = '\0';
+	return true;
+}
+
+static bool read_exact(Reader *reader, char *dest, size_t size)
+{
+	while (size > 0) {
+		if (reader->start == reader->end && !fill(reader))
+			return false;
+
+		size_t n = reader->end - reader->start;
+
+		if (n > size)
+			n = size;
+
+		memcpy(dest, reader->buffer + reader->start, n);
+		reader->start += (int)n;
+		dest += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+static bool write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		data += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+static bool reply(int fd, const char *status, const Text *body)
+{
+	char header[64];
+	int length = snprintf(header, sizeof(header), "%s %zu\n", status, body->length);
+	return write_all(fd, header, length) && write_all(fd, body->data, body->length);
+}
+
+// Reads the source of a request, false for a malformed request
+static bool read_source(Reader *reader, const char *request, FileText *source, Text *body)
+{
+	if (strncmp(request, "path ", 5) == 0) {
+		if (file_open_text(source, request + 5))
+			return true;
+
+		text_printf(body, "Error: Could not open file %s.\n", request + 5);
+		return false;
+	}
+
+	char *end = NULL;
+	unsigned long long size = 0;
+
+	if (strncmp(request, "source ", 7) == 0)
+		size = strtoull(request + 7, &end, 10);
+
+	if (!end || *end != '\0' || size > MaxSourceSize) {
+		text_printf(body, "Error: Bad request.\n");
+		return false;
+	}
+
+	char *data = malloc(size + 1);
+
+	if (!data || !read_exact(reader, data, size)) {
+		free(data);
+		return false;
+	}
+
+	data[size] = '\0';
+	source->data = data;
+	source->length = size;
+	source->mapped = 0; // see file_close_text
+	return true;
+}
+
+static void *serve_connection(void *argument)
+{
+	int fd = (int)(intptr_t)argument;
+	PooledContext *pooled = acquire_context();
+	CompilerContext *ctx = pooled->ctx;
+	Reader *reader = calloc(1, sizeof(*reader));
+	reader->fd = fd;
+	Text body = {0};
+	char request[1024];
+
+	while (read_line(reader, request, sizeof(request))) {
+		body.length = 0;
+		FileText source;
+
+		if (!read_source(reader, request, &source, &body)) {
+			// after a bad request the rest of the stream can't be trusted
+			bool framed = strncmp(request, "path ", 5) == 0;
+
+			if (body.length > 0 && reply(fd, "error", &body) && framed)
+				continue;
+
+			break;
+		}
+
+		bool ok = compiler_compile(ctx, source.data);
+		file_close_text(&source);
+		const char *name = strncmp(request, "path ", 5) == 0 ? request + 5 : "source";
+
+		if (ok) {
+			for (int i = 0; i < compiler_get_code_size(ctx); i++)
+				text_printf(&body, "%3d: %s", i, compiler_get_code_line(ctx, i));
+		}
+
+		for (int i = 0; i < compiler_get_error_count(ctx); i++) {
+			CompilerError error = compiler_get_error_at(ctx, i);
+			text_printf(&body, "%s:%d:%d: error: %s\n", name, error.line, error.column,
+			            error.message);
+		}
+
+		if (!reply(fd, ok ? "ok" : "error", &body))
+			break;
+	}
+
+	text_free(&body);
+	free(reader);
+	close(fd);
+	release_context(pooled);
+	return NULL;
+}
+
+bool server_run(const char *socket_path, const ServerOptions *options)
+{
+	struct sockaddr_un address = {0};
+	address.sun_family = AF_UNIX;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		printf("Error: Socket path %s too long.\n", socket_path);
+		return false;
+	}
+
+	strcpy(address.sun_path, socket_path);
+
+	// A socket nobody listens on is left behind by a server that ended and
+	// is replaced. A socket in use and any other file are kept.
+	struct stat status;
+
+	if (lstat(socket_path, &status) == 0) {
+		if (!S_ISSOCK(status.st_mode)) {
+			printf("Error: Socket path %s exists and is not a socket.\n", socket_path);
+			return false;
+		}
+
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool connected = probe >= 0
+		                 && connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0;
+		int error = errno;
+
+		if (probe >= 0)
+			close(probe);
+
+		if (connected) {
+			printf("Error: Socket path %s is in use.\n", socket_path);
+			return false;
+		}
+
+		if (probe < 0 || error != ECONNREFUSED) {
+			printf("Error: Could not check %s: %s.\n", socket_path, strerror(error));
+			return false;
+		}
+
+		unlink(socket_path);
+	}
+
+	g_options = *options;
+	signal(SIGPIPE, SIG_IGN); // clients may go away while we write
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (listener < 0
+	    || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0
+	    || listen(listener, SOMAXCONN) != 0) {
+		printf("Error: Could not listen on %s: %s.\n", socket_path, strerror(errno));
+		return false;
+	}
+
+	printf("Listening on %s\n", socket_path);
+	fflush(stdout);
+
+	while (true) {
+		int fd = accept(listener, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			printf("Error: accept failed: %s.\n", strerror(errno));
+			close(listener);
+			return false;
+		}
+
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, serve_connection, (void *)(intptr_t)fd) != 0) {
+			close(fd);
+			continue;
+		}
+
+		pthread_detach(thread);
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+
+/*
+ * Compile server on a Unix domain socket. A connection carries any number
+ * of requests, each answered before the next one is read:
+ *
+ *   path <file>\n              compiles the file
+ *   source <bytes>\n<text>     compiles the text following the line
+ *
+ * The reply is 'ok <bytes>\n' followed by the code, in the format of the
+ * command line driver, or 'error <bytes>\n' followed by the diagnostic.
+ * Compiler contexts are pooled, so the universe and the buffers stay warm
+ * from one request to the next.
+ */
+
+// Settings of the compiler contexts
+typedef struct {
+	int  unroll_factor; // 0 keeps the default
+	bool pretokenize;
+	int  lex_threads;   // 0 keeps the default
+	bool pipeline;
+	int  error_limit;   // 0 keeps the default
+} ServerOptions;
+
+// Serves until the process is terminated, returns false if the socket
+// can't be set up
+bool server_run(const char *socket_path, const ServerOptions *options);
+
+#endif // SERVER_H
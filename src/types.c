@@ -9,3 +9,8 @@ Type IntType = {
 	.form = TF_INT,
 	.size = 4
 };
+
+bool type_is_open_array(const Type *type)
+{
+	return type->form == TF_ARRAY && type->array.len < 0;
+}
@@ -1,5 +1,6 @@
 #ifndef TYPES_H
 #define TYPES_H
+#include <stdbool.h>
 #ifndef __cplusplus
 typedef enum TypeForm TypeForm;
 typedef struct Type Type;
@@ -24,7 +25,7 @@ struct Type {
 		} record;
 
 		struct {
-			int   len;
+			int   len;  // -1 for open arrays, see type_is_open_array
 			Type *base;
 		} array;
 	};
@@ -33,4 +34,8 @@ struct Type {
 extern Type BoolType;
 extern Type IntType;
 
+// Open arrays only occur as formal parameters. Their length is unknown at
+// compile time and is passed as a hidden word behind the address.
+bool type_is_open_array(const Type *type);
+
 #endif
@@ -1,5 +1,14 @@
 #include "utils.h"
 #include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 int string_length(const char *s)
 {
@@ -61,18 +70,25 @@ Int to_number(const char *s)
 	return negative ? -n : n;
 }
 
-bool is_digit(char c)
-{
-	if ((c >= '0' && c <= '9'))
-		return true;
+const unsigned char g_char_class[256] = {
+	['0' ... '9'] = CHAR_DIGIT | CHAR_XDIGIT | CHAR_IDENT,
+	['a' ... 'f'] = CHAR_XDIGIT | CHAR_IDENT_START | CHAR_IDENT,
+	['A' ... 'F'] = CHAR_XDIGIT | CHAR_IDENT_START | CHAR_IDENT,
+	['g' ... 'z'] = CHAR_IDENT_START | CHAR_IDENT,
+	['G' ... 'Z'] = CHAR_IDENT_START | CHAR_IDENT,
+	['_']         = CHAR_IDENT_START | CHAR_IDENT,
+	[' ']         = CHAR_SPACE,
+	['\t']        = CHAR_SPACE,
+	['\r']        = CHAR_SPACE,
+	['\n']        = CHAR_SPACE,
+};
 
-	return false;
-}
-
-bool is_xdigit(char c)
+int get_xdigit_value(int char_digit_literal)
 {
-	if (is_digit(c))
-		return true;
+	int c = char_digit_literal;
+
+	if (c >= '0' && c <= '9')
+		return c - '0';
 
 	switch (c) {
 	case 'a':
@@ -81,62 +97,143 @@ bool is_xdigit(char c)
 	case 'd':
 	case 'e':
 	case 'f':
+		return c - 'a' + 10;
+
 	case 'A':
 	case 'B':
 	case 'C':
 	case 'D':
 	case 'E':
 	case 'F':
-		return true;
+		return c - 'A' + 10;
 	}
 
-	return false;
+	assert(false);
+	return 0;
 }
 
-bool is_ident_start(char c)
+// Reads pipes, stdin and whatever can't be mapped
+static bool read_text(FileText *text, int fd)
 {
-	return
-	    (c >= 'A' && c <= 'Z')
-	    || (c >= 'a' && c <= 'z')
-	    || (c == '_')
-	    ;
+	size_t capacity = 64 * 1024;
+	size_t length = 0;
+	char *data = malloc(capacity);
+
+	while (data) {
+		if (capacity - length < 2) {
+			capacity *= 2;
+			char *larger = realloc(data, capacity);
+
+			if (!larger)
+				break;
+
+			data = larger;
+		}
+
+		ssize_t n = read(fd, data + length, capacity - length - 1);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n < 0)
+			break;
+
+		if (n == 0) {
+			data[length] = '\0';
+			text->data = data;
+			text->length = length;
+			text->mapped = 0;
+			return true;
+		}
+
+		length += n;
+	}
+
+	free(data);
+	return false;
 }
 
-bool is_ident(char c)
+// The file is mapped in front of at least one anonymous zero byte, which
+// terminates the text even if the file ends on a page boundary
+static bool map_text(FileText *text, int fd, size_t length)
 {
-	return
-	    (c >= 'A' && c <= 'Z')
-	    || (c >= 'a' && c <= 'z')
-	    || (c == '_')
-	    || is_digit(c)
-	    ;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = (length / page + 1) * page;
+	char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (base == MAP_FAILED)
+		return false;
+
+	if (length > 0
+	    && mmap(base, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, size);
+		return false;
+	}
+
+	madvise(base, size, MADV_SEQUENTIAL);
+	text->data = base;
+	text->length = length;
+	text->mapped = size;
+	return true;
 }
 
-int get_xdigit_value(int char_digit_literal)
+bool file_open_text(FileText *text, const char *filename)
 {
-	int c = char_digit_literal;
+	bool is_stdin = strcmp(filename, "-") == 0;
+	int fd = is_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
 
-	if (c >= '0' && c <= '9')
-		return c - '0';
+	if (fd < 0)
+		return false;
 
-	switch (c) {
-	case 'a':
-	case 'b':
-	case 'c':
-	case 'd':
-	case 'e':
-	case 'f':
-		return c - 'a' + 10;
+	struct stat status;
+	bool ok = false;
 
-	case 'A':
-	case 'B':
-	case 'C':
-	case 'D':
-	case 'E':
-	case 'F':
-		return c - 'A' + 10;
+	if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode))
+		ok = map_text(text, fd, (size_t)status.st_size);
+
+	if (!ok)
+		ok = read_text(text, fd);
+
+	if (!is_stdin)
+		close(fd); // the mapping stays
+
+	return ok;
+}
+
+void file_close_text(FileText *text)
+{
+	if (text->mapped > 0)
+		munmap((void *)text->data, text->mapped);
+	else
+		free((void *)text->data);
+
+	text->data = NULL;
+	text->length = 0;
+	text->mapped = 0;
+}
+
+void text_printf(Text *text, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int needed = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	if (text->length + needed + 1 > text->capacity) {
+		text->capacity = 2 * text->capacity + needed + 1;
+		text->data = realloc(text->data, text->capacity);
 	}
 
-	assert(false);
-	return 0;
+	va_start(args, format);
+	vsnprintf(text->data + text->length, needed + 1, format, args);
+	va_end(args);
+	text->length += needed;
+}
+
+void text_free(Text *text)
+{
+	free(text->data);
+	text->data = NULL;
+	text->length = 0;
+	text->capacity = 0;
 }
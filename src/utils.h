@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef long long int Int;
 
@@ -10,11 +11,65 @@ typedef long long int Int;
 int  string_length(const char *);
 bool string_equal(const char *a, const char *b);
 void string_copy(char *dest, const char *src);
-bool is_digit(char c);
-bool is_xdigit(char c);
-bool is_ident(char c);
-bool is_ident_start(char c);
 int  get_xdigit_value(int char_digit_literal);
 Int  to_number(const char *s);
 
+// Character classes, a character may be in several
+enum {
+	CHAR_DIGIT       = 1 << 0,
+	CHAR_XDIGIT      = 1 << 1,
+	CHAR_IDENT_START = 1 << 2,
+	CHAR_IDENT       = 1 << 3,
+	CHAR_SPACE       = 1 << 4, // ' ', '\t', '\r' and '\n'
+};
+
+extern const unsigned char g_char_class[256];
+
+static inline bool has_char_class(char c, int classes)
+{
+	return (g_char_class[(unsigned char)c] & classes) != 0;
+}
+
+static inline bool is_digit(char c)
+{
+	return has_char_class(c, CHAR_DIGIT);
+}
+
+static inline bool is_xdigit(char c)
+{
+	return has_char_class(c, CHAR_XDIGIT);
+}
+
+static inline bool is_ident(char c)
+{
+	return has_char_class(c, CHAR_IDENT);
+}
+
+static inline bool is_ident_start(char c)
+{
+	return has_char_class(c, CHAR_IDENT_START);
+}
+
+// Text of a file terminated by '\0'. Regular files are mapped, so the
+// text is read straight from the page cache. Pipes and stdin, named "-",
+// are read into memory.
+typedef struct {
+	const char *data;
+	size_t      length;
+	size_t      mapped; // bytes mapped, 0 if the text was read
+} FileText;
+
+bool file_open_text(FileText *text, const char *filename); // false if it can't be read
+void file_close_text(FileText *text);
+
+// Growing text, e.g. to collect the output of a compilation
+typedef struct {
+	char  *data;
+	size_t length;
+	size_t capacity;
+} Text;
+
+void text_printf(Text *text, const char *format, ...);
+void text_free(Text *text);
+
 #endif // UTILS_H
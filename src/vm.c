@@ -0,0 +1,537 @@
+#include "vm.h"
+#include "compiler.h"
+#include "abstract_machine.h"
+#include "utils.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Register and immediate forms of each operation are separate codes, so
+// the interpreter dispatches once per instruction
+typedef enum {
+	VM_NOP, // a label
+	VM_MOV, VM_MOVI,
+	VM_AND, VM_ANDI, VM_OR, VM_ORI, VM_XOR, VM_XORI,
+	VM_LSH, VM_LSHI, VM_RSH, VM_RSHI,
+	VM_ADD, VM_ADDI, VM_SUB, VM_SUBI, VM_MUL, VM_MULI,
+	VM_DIV, VM_DIVI, VM_MOD, VM_MODI,
+	VM_CMP, VM_CMPI,
+	VM_LOAD,  // a := mem[b + c]
+	VM_STORE, // mem[b + c] := a
+	VM_SET, VM_CMOV,
+	VM_JUMP,  // to c if cc holds
+	VM_JUMPR, // to register a if cc holds
+	VM_READ, VM_WRITE, VM_WRITELN,
+} Code;
+
+// a is the destination, b the left operand, c the right operand, an
+// immediate value or the target of a jump
+typedef struct {
+	uint8_t code;
+	uint8_t cc;
+	uint8_t a;
+	uint8_t b;
+	int32_t c;
+} Instruction;
+
+enum { RegisterCount = 16, GB = 13, SP = 14 };
+
+struct VirtualMachine {
+	Instruction *code;
+	int          count;
+	int          capacity;
+	int          entry;
+	int32_t     *memory;
+	int          memory_size; // in bytes
+	long long    limit;
+	long long    executed;
+	Text         output;
+	char         error[MAX_STRLEN];
+};
+
+VirtualMachine *vm_create(int memory_size)
+{
+	assert(memory_size > 0 && memory_size % 4 == 0);
+	VirtualMachine *vm = calloc(1, sizeof(*vm));
+
+	if (!vm)
+		return NULL;
+
+	vm->memory = calloc(memory_size / 4, sizeof(*vm->memory));
+
+	if (!vm->memory) {
+		free(vm);
+		return NULL;
+	}
+
+	vm->memory_size = memory_size;
+	return vm;
+}
+
+void vm_destroy(VirtualMachine *vm)
+{
+	if (!vm)
+		return;
+
+	free(vm->code);
+	free(vm->memory);
+	text_free(&vm->output);
+	free(vm);
+}
+
+void vm_set_instruction_limit(VirtualMachine *vm, long long limit)
+{
+	assert(limit >= 0);
+	vm->limit = limit;
+}
+
+static bool fail(VirtualMachine *vm, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vsnprintf(vm->error, sizeof(vm->error), format, args);
+	va_end(args);
+	return false;
+}
+
+//--------------------------------------------------------------------------
+// Decoding of the lines written by abstract_machine.c
+
+static bool accept(const char **p, const char *text)
+{
+	size_t length = strlen(text);
+
+	if (strncmp(*p, text, length) != 0)
+		return false;
+
+	*p += length;
+	return true;
+}
+
+static int parse_register(const char **p)
+{
+	static const char *const Names[] = {"GB", "SP", "LNK"};
+
+	for (int i = 0; i < 3; i++) {
+		if (accept(p, Names[i]))
+			return GB + i;
+	}
+
+	if (**p != 'R' || !is_digit((*p)[1]))
+		return -1;
+
+	char *end;
+	long reg = strtol(*p + 1, &end, 10);
+
+	if (reg >= GB)
+		return -1;
+
+	*p = end;
+	return (int)reg;
+}
+
+static bool parse_number(const char **p, int32_t *value)
+{
+	while (**p == ' ')
+		*p += 1;
+
+	char *end;
+	long number = strtol(*p, &end, 10);
+
+	if (end == *p || number < INT32_MIN || number > INT32_MAX)
+		return false;
+
+	*p = end;
+	*value = (int32_t)number;
+	return true;
+}
+
+// A register or a number, the immediate form is the code following 'code'
+static bool parse_operand(const char **p, Instruction *instruction, Code code)
+{
+	int reg = parse_register(p);
+
+	if (reg >= 0) {
+		instruction->code = code;
+		instruction->c = reg;
+		return true;
+	}
+
+	instruction->code = code + 1;
+	return parse_number(p, &instruction->c);
+}
+
+static int parse_condition(const char **p)
+{
+	// longer names first
+	static const struct {
+		const char   *name;
+		ConditionCode cc;
+	} Conditions[] = {
+		{"ne", CC_NOT_EQUAL}, {"le", CC_LESS_EQUAL}, {"ge", CC_GREATER_EQUAL},
+		{"e", CC_EQUAL}, {"l", CC_LESS}, {"g", CC_GREATER}, {"mp", CC_TRUE},
+	};
+
+	for (size_t i = 0; i < ARRAY_COUNT(Conditions); i++) {
+		if (accept(p, Conditions[i].name))
+			return Conditions[i].cc;
+	}
+
+	return -1;
+}
+
+// mem[base + offset]
+static bool parse_memory(const char **p, Instruction *instruction)
+{
+	int base = parse_register(p);
+	instruction->b = (uint8_t)base;
+	return base >= 0 && accept(p, " +") && parse_number(p, &instruction->c) && accept(p, "]");
+}
+
+static bool parse_assignment(const char **p, Instruction *instruction)
+{
+	static const struct {
+		const char *name;
+		Code        code;
+	} Operators[] = {
+		{" and ", VM_AND}, {" or ", VM_OR}, {" xor ", VM_XOR}, {" << ", VM_LSH},
+		{" >> ", VM_RSH}, {" + ", VM_ADD}, {" - ", VM_SUB}, {" * ", VM_MUL},
+		{" / ", VM_DIV}, {" % ", VM_MOD},
+	};
+
+	if (accept(p, "mem[")) {
+		instruction->code = VM_LOAD;
+		return parse_memory(p, instruction);
+	}
+
+	int lhs = parse_register(p);
+
+	if (lhs < 0) {
+		instruction->code = VM_MOVI;
+		return parse_number(p, &instruction->c);
+	}
+
+	instruction->b = (uint8_t)lhs;
+
+	for (size_t i = 0; i < ARRAY_COUNT(Operators); i++) {
+		if (accept(p, Operators[i].name))
+			return parse_operand(p, instruction, Operators[i].code);
+	}
+
+	instruction->code = VM_MOV;
+	instruction->c = lhs;
+	return true;
+}
+
+static bool parse_line(const char *p, int pc, Instruction *instruction)
+{
+	memset(instruction, 0, sizeof(*instruction));
+	int reg;
+
+	if (accept(&p, "mem[")) {
+		instruction->code = VM_STORE;
+
+		if (!parse_memory(&p, instruction) || !accept(&p, " := "))
+			return false;
+
+		reg = parse_register(&p);
+		instruction->a = (uint8_t)reg;
+		return reg >= 0 && *p == '\n';
+	}
+
+	if (accept(&p, "cmp ")) {
+		reg = parse_register(&p);
+		instruction->b = (uint8_t)reg;
+		return reg >= 0 && accept(&p, ", ") && parse_operand(&p, instruction, VM_CMP)
+		       && *p == '\n';
+	}
+
+	if (accept(&p, "writeln")) {
+		instruction->code = VM_WRITELN;
+		return *p == '\n';
+	}
+
+	bool read = accept(&p, "read ");
+
+	if (read || accept(&p, "write ")) {
+		instruction->code = read ? VM_READ : VM_WRITE;
+		reg = parse_register(&p);
+		instruction->a = (uint8_t)reg;
+		return reg >= 0 && *p == '\n';
+	}
+
+	bool set = accept(&p, "set");
+
+	if (set || accept(&p, "cmov")) {
+		int cc = parse_condition(&p);
+
+		if (cc < 0 || cc == CC_TRUE || !accept(&p, " "))
+			return false;
+
+		instruction->code = set ? VM_SET : VM_CMOV;
+		instruction->cc = (uint8_t)cc;
+		reg = parse_register(&p);
+		instruction->a = (uint8_t)reg;
+
+		if (reg < 0)
+			return false;
+
+		if (!set) {
+			if (!accept(&p, ", "))
+				return false;
+
+			reg = parse_register(&p);
+			instruction->b = (uint8_t)reg;
+
+			if (reg < 0)
+				return false;
+		}
+
+		return *p == '\n';
+	}
+
+	if (accept(&p, "j")) {
+		int cc = parse_condition(&p);
+
+		if (cc < 0)
+			return false;
+
+		instruction->cc = (uint8_t)cc;
+
+		while (*p == ' ')
+			p++;
+
+		reg = parse_register(&p);
+
+		if (reg >= 0) {
+			instruction->code = VM_JUMPR;
+			instruction->a = (uint8_t)reg;
+			return *p == '\n';
+		}
+
+		instruction->code = VM_JUMP;
+
+		if (!parse_number(&p, &instruction->c))
+			return false;
+
+		instruction->c += pc + 1;
+		return *p == '\n';
+	}
+
+	reg = parse_register(&p);
+
+	if (reg >= 0) {
+		instruction->a = (uint8_t)reg;
+		return accept(&p, " := ") && parse_assignment(&p, instruction) && *p == '\n';
+	}
+
+	// a label
+	while (is_ident(*p))
+		p++;
+
+	instruction->code = VM_NOP;
+	return accept(&p, ":") && *p == '\n';
+}
+
+bool vm_load(VirtualMachine *vm, const CompilerContext *ctx)
+{
+	vm->count = compiler_get_code_size(ctx);
+	vm->entry = compiler_get_entry_point(ctx);
+
+	if (vm->count > vm->capacity) {
+		free(vm->code);
+		vm->capacity = vm->count;
+		vm->code = malloc(vm->capacity * sizeof(*vm->code));
+
+		if (!vm->code)
+			abort(); // out of memory
+	}
+
+	if (vm->entry < 0)
+		return fail(vm, "no module code");
+
+	for (int pc = 0; pc < vm->count; pc++) {
+		const char *line = compiler_get_code_line(ctx, pc);
+		Instruction *instruction = &vm->code[pc];
+
+		if (!parse_line(line, pc, instruction))
+			return fail(vm, "pc %d: bad instruction %s", pc, line);
+
+		if (instruction->code == VM_JUMP && (instruction->c < 0 || instruction->c > vm->count))
+			return fail(vm, "pc %d: jump out of the code", pc);
+	}
+
+	vm->error[0] = '\0';
+	return true;
+}
+
+//--------------------------------------------------------------------------
+// Execution
+
+static bool holds(int cc, int compared)
+{
+	switch ((ConditionCode)cc) {
+	case CC_TRUE:          return true;
+	case CC_FALSE:         return false;
+	case CC_EQUAL:         return compared == 0;
+	case CC_NOT_EQUAL:     return compared != 0;
+	case CC_LESS:          return compared < 0;
+	case CC_LESS_EQUAL:    return compared <= 0;
+	case CC_GREATER:       return compared > 0;
+	case CC_GREATER_EQUAL: return compared >= 0;
+	}
+
+	return false;
+}
+
+// Words are aligned, NULL outside of the memory
+static int32_t *word_at(VirtualMachine *vm, int32_t address)
+{
+	if (address < 0 || address >= vm->memory_size || address % 4 != 0)
+		return NULL;
+
+	return &vm->memory[address / 4];
+}
+
+// Arithmetic wraps around like the 32 bit machine it models
+static int32_t wrap(int64_t value)
+{
+	return (int32_t)(uint32_t)(uint64_t)value;
+}
+
+bool vm_run(VirtualMachine *vm, const char *input)
+{
+	int32_t r[RegisterCount] = {0};
+	int compared = 0; // of the last cmp, below, equal or above 0
+	long long executed = 0;
+	long long labels = 0;
+	int pc = vm->entry;
+	bool ok = true;
+	vm->output.length = 0;
+	vm->error[0] = '\0';
+	memset(vm->memory, 0, vm->memory_size);
+	r[SP] = vm->memory_size;
+
+	while (ok && pc < vm->count) {
+		const Instruction *i = &vm->code[pc];
+		int32_t b = r[i->b];
+		int32_t c = i->c;
+		int32_t *word;
+		executed += 1;
+		pc += 1;
+
+		switch (i->code) {
+		case VM_NOP:   labels += 1; break;
+		case VM_MOV:   r[i->a] = r[c]; break;
+		case VM_MOVI:  r[i->a] = c; break;
+		case VM_AND:   c = r[c]; // fall through
+		case VM_ANDI:  r[i->a] = b & c; break;
+		case VM_OR:    c = r[c]; // fall through
+		case VM_ORI:   r[i->a] = b | c; break;
+		case VM_XOR:   c = r[c]; // fall through
+		case VM_XORI:  r[i->a] = b ^ c; break;
+		case VM_LSH:   c = r[c]; // fall through
+		case VM_LSHI:  r[i->a] = wrap((uint32_t)b << (c & 31)); break;
+		case VM_RSH:   c = r[c]; // fall through
+		case VM_RSHI:  r[i->a] = b >> (c & 31); break;
+		case VM_ADD:   c = r[c]; // fall through
+		case VM_ADDI:  r[i->a] = wrap((int64_t)b + c); break;
+		case VM_SUB:   c = r[c]; // fall through
+		case VM_SUBI:  r[i->a] = wrap((int64_t)b - c); break;
+		case VM_MUL:   c = r[c]; // fall through
+		case VM_MULI:  r[i->a] = wrap((int64_t)b * c); break;
+		case VM_DIV:   c = r[c]; // fall through
+		case VM_DIVI:
+			if (c == 0)
+				ok = fail(vm, "pc %d: division by zero", pc - 1);
+			else
+				r[i->a] = wrap((int64_t)b / c);
+
+			break;
+
+		case VM_MOD:   c = r[c]; // fall through
+		case VM_MODI:
+			if (c == 0)
+				ok = fail(vm, "pc %d: division by zero", pc - 1);
+			else
+				r[i->a] = wrap((int64_t)b % c);
+
+			break;
+
+		case VM_CMP:   c = r[c]; // fall through
+		case VM_CMPI:  compared = (b > c) - (b < c); break;
+		case VM_SET:   r[i->a] = holds(i->cc, compared); break;
+
+		case VM_CMOV:
+			if (holds(i->cc, compared))
+				r[i->a] = b;
+
+			break;
+
+		case VM_LOAD:
+		case VM_STORE:
+			word = word_at(vm, wrap((int64_t)b + c));
+
+			if (!word)
+				ok = fail(vm, "pc %d: bad address %d", pc - 1, wrap((int64_t)b + c));
+			else if (i->code == VM_LOAD)
+				r[i->a] = *word;
+			else
+				*word = r[i->a];
+
+			break;
+
+		case VM_JUMP:
+		case VM_JUMPR:
+			if (!holds(i->cc, compared))
+				break;
+
+			pc = i->code == VM_JUMP ? c : r[i->a];
+
+			// every endless run passes here
+			if (pc < 0 || pc > vm->count)
+				ok = fail(vm, "pc %d: jump to %d", (int)(i - vm->code), pc);
+			else if (vm->limit > 0 && executed - labels > vm->limit)
+				ok = fail(vm, "more than %lld instructions", vm->limit);
+
+			break;
+
+		case VM_READ: {
+			char *end;
+			long value = strtol(input, &end, 10);
+
+			if (end == input)
+				ok = fail(vm, "pc %d: no more input", pc - 1);
+
+			r[i->a] = wrap(value);
+			input = end;
+			break;
+		}
+
+		case VM_WRITE:   text_printf(&vm->output, " %d", r[i->a]); break;
+		case VM_WRITELN: text_printf(&vm->output, "\n"); break;
+		}
+	}
+
+	vm->executed = executed - labels;
+	return ok;
+}
+
+const char *vm_get_output(const VirtualMachine *vm)
+{
+	return vm->output.length > 0 ? vm->output.data : "";
+}
+
+const char *vm_get_error(const VirtualMachine *vm)
+{
+	return vm->error[0] ? vm->error : NULL;
+}
+
+long long vm_get_instruction_count(const VirtualMachine *vm)
+{
+	return vm->executed;
+}
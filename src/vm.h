@@ -0,0 +1,37 @@
+#ifndef VM_H
+#define VM_H
+#include <stdbool.h>
+#ifndef __cplusplus
+typedef struct CompilerContext CompilerContext;
+typedef struct VirtualMachine VirtualMachine;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Executes the code of a compilation. The lines are decoded into
+// instructions once, a run starts at the statements of the module and ends
+// behind the last line. All registers start at 0 except SP, which points
+// behind the memory; the globals are addressed from GB upwards, the
+// procedure frames from SP downwards.
+VirtualMachine *vm_create(int memory_size); // in bytes
+void            vm_destroy(VirtualMachine *vm);
+// Takes the code of the last successful compilation with 'ctx', returns
+// false if a line is not understood
+bool            vm_load(VirtualMachine *vm, const CompilerContext *ctx);
+// Stops a run after this many instructions, 0 by default, no limit
+void            vm_set_instruction_limit(VirtualMachine *vm, long long limit);
+// Runs the loaded code, returns false if it traps. read() takes the
+// integers of 'input', separated by white space, write() appends a space
+// and the number to the output, writeln a new line.
+bool            vm_run(VirtualMachine *vm, const char *input);
+const char     *vm_get_output(const VirtualMachine *vm);  // of the last run
+const char     *vm_get_error(const VirtualMachine *vm);   // NULL after a successful run
+long long       vm_get_instruction_count(const VirtualMachine *vm); // executed, labels not counted
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VM_H